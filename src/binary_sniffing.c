@@ -0,0 +1,125 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pread
+#define _POSIX_C_SOURCE 200809L
+
+#include "endlines.h"
+#include "scan_kernels.h"
+
+#include <string.h>
+#include <unistd.h>
+
+
+// SEE endlines.h FOR INTERFACE DOCUMENTATION
+
+
+// Signatures that common binary formats start with.
+// Only those that hold a non-text character are listed : signatures made of printable
+// characters only (GIF89a, %PDF-, PAR1...) can just as well start a text file.
+// The control characters test would catch these too, but only after scanning the head.
+
+typedef struct {
+    const char *bytes;
+    size_t length;
+} Binary_signature;
+
+#define SIGNATURE(s) {s, sizeof(s) - 1}
+
+static const Binary_signature binary_signatures[] = {
+    SIGNATURE("\x7f" "ELF\x01"),            // ELF executables, objects and libraries, 32 bit
+    SIGNATURE("\x7f" "ELF\x02"),            //   and 64 bit
+    SIGNATURE("\xca\xfe\xba\xbe\0"),        // Java classes, Mach-O fat binaries
+    SIGNATURE("\0asm"),                     // WebAssembly
+    SIGNATURE("PK\x03\x04"),                // zip, jar, docx, xlsx, apk...
+    SIGNATURE("PK\x05\x06"),                // empty zip
+    SIGNATURE("\x1f\x8b"),                  // gzip
+    SIGNATURE("\xfd" "7zXZ\0"),             // xz
+    SIGNATURE("7z\xbc\xaf\x27\x1c"),        // 7-zip
+    SIGNATURE("Rar!\x1a\x07"),              // rar
+    SIGNATURE("\x89PNG\r\n\x1a\n"),         // png
+    SIGNATURE("SQLite format 3\0"),         // sqlite databases
+    SIGNATURE("OggS\0"),                    // ogg
+    SIGNATURE("\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1")   // legacy office documents (doc, xls, ppt, msi)
+};
+
+#define BINARY_SIGNATURES_COUNT ((int)(sizeof(binary_signatures)/sizeof(binary_signatures[0])))
+
+
+static bool
+starts_with_binary_signature(const BYTE *head, size_t size)
+{
+    for(int i=0; i<BINARY_SIGNATURES_COUNT; ++i) {
+        const Binary_signature *s = &(binary_signatures[i]);
+        if(size >= s->length && !memcmp(head, s->bytes, s->length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A single non-text character is enough for convert_stream to deem a file binary :
+// the head is looked at 64 bytes at a time for one.
+static bool
+holds_non_text_byte(const BYTE *head, size_t size)
+{
+    size_t i = 0;
+    Byte_block_masks masks;
+    for(; i + BYTE_BLOCK_SIZE <= size; i += BYTE_BLOCK_SIZE) {
+        classify_byte_block(head + i, &masks);
+        if(masks.special & ~(masks.cr | masks.lf)) {
+            return true;
+        }
+    }
+    for(; i < size; ++i) {
+        if(is_special_code(head[i]) && head[i] != 13 && head[i] != 10) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+starts_with_utf16_bom(const BYTE *head, size_t size)
+{
+    return size >= 2 && ((head[0] == 0xFF && head[1] == 0xFE) || (head[0] == 0xFE && head[1] == 0xFF));
+}
+
+
+bool
+looks_like_binary_head(const BYTE *head, size_t size)
+{
+    if(starts_with_binary_signature(head, size)) {
+        return true;
+    }
+    // In 16 bit layouts, most code units hold a zero byte : only convert_stream can tell.
+    return !starts_with_utf16_bom(head, size) && holds_non_text_byte(head, size);
+}
+
+
+bool
+sniffs_as_binary(int in, Input_mapping *mapping)
+{
+    if(mapping->contents != NULL) {
+        size_t size = mapping->size < SNIFFED_HEAD_SIZE ? mapping->size : SNIFFED_HEAD_SIZE;
+        return looks_like_binary_head(mapping->contents, size);
+    }
+    BYTE head[SNIFFED_HEAD_SIZE];
+    ssize_t got = pread(in, head, SNIFFED_HEAD_SIZE, 0);
+    return got > 0 && looks_like_binary_head(head, (size_t)got);
+}
@@ -0,0 +1,259 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pthreads
+#define _POSIX_C_SOURCE 200809L
+
+#include "buffer_ring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// SEE buffer_ring.h FOR INTERFACE DOCUMENTATION
+
+
+// Buffers are filled by the producer (the ring's thread for reading rings, its user for writing
+// rings), then used by the consumer, in order. filled and used count buffers since the start :
+// buffer i is at index i % RING_BUFFER_COUNT. The producer waits while all buffers are filled
+// and not used yet, and the consumer waits while there's no filled buffer.
+// Each side holds the buffer it's working on until its next call.
+
+struct Buffer_ring {
+    int fd;
+    bool writing;
+    size_t buffer_size;
+    BYTE *buffers[RING_BUFFER_COUNT];
+    size_t sizes[RING_BUFFER_COUNT];
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    unsigned long filled;
+    unsigned long used;
+    bool holding;         // the ring's user holds a buffer
+    bool reached_end;     // reading rings : the user got the end of the input
+    bool finishing;       // writing rings : nothing more will be handed over
+    bool io_error;
+    pthread_t thread;
+};
+
+
+// Producer side : waits for room, and returns the buffer to fill.
+static BYTE *
+wait_for_empty_buffer(Buffer_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    while(ring->filled - ring->used == RING_BUFFER_COUNT) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    BYTE *buffer = ring->buffers[ring->filled % RING_BUFFER_COUNT];
+    pthread_mutex_unlock(&ring->lock);
+    return buffer;
+}
+
+static void
+publish_buffer(Buffer_ring *ring, size_t size)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->sizes[ring->filled % RING_BUFFER_COUNT] = size;
+    ++ ring->filled;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Consumer side : waits for a filled buffer, and returns it.
+// Returns NULL if there's none left, and none will come.
+static BYTE *
+wait_for_filled_buffer(Buffer_ring *ring, size_t *size)
+{
+    pthread_mutex_lock(&ring->lock);
+    while(ring->filled == ring->used && !ring->finishing) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    BYTE *buffer = NULL;
+    if(ring->filled != ring->used) {
+        buffer = ring->buffers[ring->used % RING_BUFFER_COUNT];
+        *size = ring->sizes[ring->used % RING_BUFFER_COUNT];
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return buffer;
+}
+
+static void
+release_buffer(Buffer_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ++ ring->used;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+
+// The first buffer is read into until it holds FIRST_BUFFER_MIN_SIZE bytes, or the input ends.
+static void *
+run_reader(void *p_ring)
+{
+    Buffer_ring *ring = (Buffer_ring *)p_ring;
+    size_t min_size = FIRST_BUFFER_MIN_SIZE;
+    size_t size;
+    do {
+        BYTE *buffer = wait_for_empty_buffer(ring);
+        ssize_t got;
+        size = 0;
+        do {
+            got = read(ring->fd, buffer + size, ring->buffer_size - size);
+            if(got > 0) {
+                size += (size_t)got;
+            }
+        } while((got < 0 && errno == EINTR) || (got > 0 && size < min_size));
+        if(got < 0) {
+            ring->io_error = true;    // read by the user once the thread is joined
+        }
+        publish_buffer(ring, size);
+        min_size = 1;
+    } while(size > 0);    // the end comes up again, after a short first buffer
+    return NULL;
+}
+
+// After a write error, the rest is dropped : the ring's user never waits for nothing.
+static void *
+run_writer(void *p_ring)
+{
+    Buffer_ring *ring = (Buffer_ring *)p_ring;
+    size_t size;
+    BYTE *buffer;
+    while((buffer = wait_for_filled_buffer(ring, &size)) != NULL) {
+        size_t written_so_far = 0;
+        while(!ring->io_error && written_so_far < size) {
+            ssize_t written = write(ring->fd, buffer + written_so_far, size - written_so_far);
+            if(written < 0 && errno == EINTR) {
+                continue;
+            }
+            if(written <= 0) {
+                ring->io_error = true;
+                break;
+            }
+            written_so_far += (size_t)written;
+        }
+        release_buffer(ring);
+    }
+    return NULL;
+}
+
+
+static void
+free_ring(Buffer_ring *ring)
+{
+    for(int i=0; i<RING_BUFFER_COUNT; ++i) {
+        free(ring->buffers[i]);
+    }
+    free(ring);
+}
+
+static Buffer_ring *
+new_ring(int fd, size_t buffer_size, bool writing)
+{
+    Buffer_ring *ring = calloc(1, sizeof(Buffer_ring));
+    if(ring == NULL) {
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->writing = writing;
+    ring->buffer_size = buffer_size;
+    for(int i=0; i<RING_BUFFER_COUNT; ++i) {
+        ring->buffers[i] = malloc(buffer_size);
+        if(ring->buffers[i] == NULL) {
+            free_ring(ring);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+    if(pthread_create(&ring->thread, NULL, writing ? run_writer : run_reader, ring)) {
+        pthread_mutex_destroy(&ring->lock);
+        pthread_cond_destroy(&ring->changed);
+        free_ring(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+Buffer_ring *
+new_reading_ring(int fd, size_t buffer_size)
+{
+    return new_ring(fd, buffer_size, false);
+}
+
+Buffer_ring *
+new_writing_ring(int fd, size_t buffer_size)
+{
+    return new_ring(fd, buffer_size, true);
+}
+
+
+// Past the end of the input, the end buffer, that is empty, keeps being returned.
+BYTE *
+next_read_buffer(Buffer_ring *ring, size_t *size)
+{
+    if(ring->reached_end) {
+        *size = 0;
+        return ring->buffers[ring->used % RING_BUFFER_COUNT];
+    }
+    if(ring->holding) {
+        release_buffer(ring);
+    }
+    BYTE *buffer = wait_for_filled_buffer(ring, size);
+    ring->holding = true;
+    ring->reached_end = (*size == 0);
+    return buffer;
+}
+
+BYTE *
+next_write_buffer(Buffer_ring *ring, size_t size)
+{
+    if(ring->holding && size > 0) {
+        publish_buffer(ring, size);
+    }
+    ring->holding = true;
+    return wait_for_empty_buffer(ring);
+}
+
+
+bool
+finish_buffer_ring(Buffer_ring *ring)
+{
+    if(ring->writing) {
+        pthread_mutex_lock(&ring->lock);
+        ring->finishing = true;
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    } else {
+        size_t size;
+        while(!ring->reached_end) {
+            next_read_buffer(ring, &size);
+        }
+    }
+    pthread_join(ring->thread, NULL);
+    bool ok = !ring->io_error;
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->changed);
+    free_ring(ring);
+    return ok;
+}
@@ -0,0 +1,76 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _BUFFER_RING_H_
+#define _BUFFER_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef BYTE
+#define BYTE unsigned char
+#endif
+
+//
+// The buffer ring : a few buffers that go round between a thread of its own, that reads
+// from (or writes to) a file descriptor, and the thread that converts their contents.
+//
+// Reading from a pipe, converting and writing to another pipe one after the other, each pipe
+// sits idle while the other two steps run. With a reading ring and a writing ring, the three
+// steps run at once.
+//
+// Each ring has one single user besides its own thread.
+//
+
+// Number of buffers in a ring.
+#define RING_BUFFER_COUNT 8
+
+// A reading ring's first buffer holds at least this many bytes, unless the input is shorter :
+// enough for a byte order mark, even when a pipe hands out fewer bytes at once.
+#define FIRST_BUFFER_MIN_SIZE 2
+
+
+typedef struct Buffer_ring Buffer_ring;
+
+
+// Starts a thread that reads fd into the ring's buffers of buffer_size bytes, up to its end.
+// Returns NULL if the thread can't be started : fd should then be read directly.
+Buffer_ring *new_reading_ring(int fd, size_t buffer_size);
+
+// Starts a thread that writes to fd whatever it's handed over in the ring's buffers.
+// Returns NULL if the thread can't be started : fd should then be written directly.
+Buffer_ring *new_writing_ring(int fd, size_t buffer_size);
+
+
+// Reading rings : hands the previously returned buffer back to the ring, and returns the next
+// one read, setting *size to the number of bytes it holds. That's 0 at the end of the input.
+BYTE *next_read_buffer(Buffer_ring *ring, size_t *size);
+
+// Writing rings : hands over the first size bytes of the previously returned buffer, if any,
+// to be written, and returns the next buffer to fill, of buffer_size bytes.
+BYTE *next_write_buffer(Buffer_ring *ring, size_t size);
+
+
+// Waits for the ring's thread to be done, then frees the ring.
+// A reading ring's thread is done at the end of its input : whatever is left unread is read
+// and dropped. A writing ring's thread is done once it has written all it's been handed over.
+// Returns false if an IO error occured.
+bool finish_buffer_ring(Buffer_ring *ring);
+
+
+#endif
@@ -92,17 +92,45 @@ strip_prefix_from(char *prefix, char *s)
 }
 
 
+// Value of a flag that takes one : what comes after it in the same argv item (skipping
+// a "=" if any), or else the next argv item, that's then consumed.
+static char*
+take_flag_value(char *rest_of_arg, int argc, char **argv, int *arg_index,
+                Command_Line_Schema *schema, const char *flag_display_name)
+{
+    if(*rest_of_arg == '=') {
+        ++ rest_of_arg;
+    }
+    if(*rest_of_arg != 0) {
+        return rest_of_arg;
+    }
+    if(*arg_index + 1 < argc) {
+        ++ *arg_index;
+        return argv[*arg_index];
+    }
+    fprintf(stderr, "%s : option %s needs a value\n", schema->program_name, flag_display_name);
+    exit(1);
+}
+
 static void
-process_long_flag(char *full_flag_arg, Command_Line_Schema *schema, void *context)
+process_long_flag(char *full_flag_arg, int argc, char **argv, int *arg_index,
+                  Command_Line_Schema *schema, void *context)
 {
     size_t flag_name_length = strcspn(full_flag_arg, flag_name_terminators);  // length of anything before "="
 
     for(int i=0; i<schema->number_of_flag_descriptions; i++) {
-        if(schema->flag_descriptions[i].long_flag != NULL) {
-            size_t ref_flag_name_length = strlen(schema->flag_descriptions[i].long_flag);
+        Command_Line_Flag *flag = &(schema->flag_descriptions[i]);
+        if(flag->long_flag != NULL) {
+            size_t ref_flag_name_length = strlen(flag->long_flag);
             if(flag_name_length == ref_flag_name_length &&
-               !strncmp(full_flag_arg, schema->flag_descriptions[i].long_flag, flag_name_length)) {
-                schema->flag_descriptions[i].callback(full_flag_arg, context);
+               !strncmp(full_flag_arg, flag->long_flag, flag_name_length)) {
+                if(flag->takes_value) {
+                    flag->callback(take_flag_value(full_flag_arg + flag_name_length, argc, argv,
+                                                   arg_index, schema, argv[*arg_index]),
+                                   context);
+                } else {
+                    flag->callback(full_flag_arg, context);
+                }
                 return;
             }
         }
@@ -111,25 +139,39 @@ process_long_flag(char *full_flag_arg, Command_Line_Schema *schema, void *contex
     exit(1);
 }
 
-static void
-process_short_flag(char flag, char *full_flag_arg, Command_Line_Schema *schema, void *context)
+// Returns true if the flag took a value, that is the rest of the bag or the next argv item.
+static bool
+process_short_flag(char *flag_in_bag, char *full_flag_arg, int argc, char **argv, int *arg_index,
+                   Command_Line_Schema *schema, void *context)
 {
     for(int i=0; i<schema->number_of_flag_descriptions; i++) {
-        if(schema->flag_descriptions[i].short_flag == flag) {
-            schema->flag_descriptions[i].callback(full_flag_arg, context);
-            return;
+        Command_Line_Flag *flag = &(schema->flag_descriptions[i]);
+        if(flag->short_flag == *flag_in_bag) {
+            if(flag->takes_value) {
+                char flag_display_name[3] = {'-', *flag_in_bag, 0};
+                flag->callback(take_flag_value(flag_in_bag + 1, argc, argv, arg_index,
+                                               schema, flag_display_name),
+                               context);
+                return true;
+            }
+            flag->callback(full_flag_arg, context);
+            return false;
         }
     }
-    fprintf(stderr, "%s : unknown option : -%c\n", schema->program_name, flag);
+    fprintf(stderr, "%s : unknown option : -%c\n", schema->program_name, *flag_in_bag);
     exit(1);
 }
 
 static void
-process_short_flags(char *full_bag_of_flags, Command_Line_Schema *schema, void *context)
+process_short_flags(char *full_bag_of_flags, int argc, char **argv, int *arg_index,
+                    Command_Line_Schema *schema, void *context)
 {
     size_t flag_bag_length = strcspn(full_bag_of_flags, flag_name_terminators);  // length of anything before "="
     for(size_t flag_index=0 ; flag_index<flag_bag_length ; flag_index++) {
-        process_short_flag( full_bag_of_flags[flag_index], full_bag_of_flags, schema, context);
+        if(process_short_flag(&(full_bag_of_flags[flag_index]), full_bag_of_flags,
+                              argc, argv, arg_index, schema, context)) {
+            return;
+        }
     }
 }
 
@@ -143,13 +185,13 @@ parse_command_line(int argc, char **argv,
     for(int i=1; i<argc; i++) {
         char *stripped_arg = strip_prefix_from("--", argv[i]);
         if(stripped_arg != NULL) {
-            process_long_flag(stripped_arg, schema, context);
+            process_long_flag(stripped_arg, argc, argv, &i, schema, context);
             continue;
         }
 
         stripped_arg = strip_prefix_from("-", argv[i]);
         if(stripped_arg != NULL) {
-            process_short_flags(stripped_arg, schema, context);
+            process_short_flags(stripped_arg, argc, argv, &i, schema, context);
             continue;
         }
 
@@ -20,6 +20,8 @@
 #ifndef _COMMAND_LINE_PARSER_H_
 #define _COMMAND_LINE_PARSER_H_
 
+#include <stdbool.h>
+
 
 // A simple generic command-line parser.
 // -------------------------------------
@@ -54,11 +56,17 @@
 // The callback function will be provided with :
 //   - first arg : a string, the whole argv item that triggered that call ; for example : "--verbose" or "-vlx"
 //   - second arg : the user-defined context object that you have passed to parse_command_line in the first place.
+//
+// A flag can take a value, if takes_value is true. It can then be given as "--jobs=4", "--jobs 4",
+// "-j4", "-j=4" or "-j 4" (a short flag takes the rest of its bag of flags as its value, if any).
+// The callback's first arg is then the value alone, e.g. "4".
+// If the value is missing, parse_command_line displays an error message and calls exit().
 
 typedef struct {
     char short_flag;
     char *long_flag;
     void (*callback)(const char *full_flag_argument, void *context);
+    bool takes_value;
 } Command_Line_Flag;
 
 
@@ -16,9 +16,15 @@
    limitations under the License.
 */
 
+#include "buffer_ring.h"
 #include "endlines.h"
+#include "scan_kernels.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 
 // SEE endlines.h FOR INTERFACE DOCUMENTATION
@@ -40,11 +46,13 @@
 
 typedef unsigned int code_point_t;
 
-typedef enum {
-    WT_1BYTE,
-    WT_2BYTE_LE,
-    WT_2BYTE_BE
-} Encoding_layout;
+// Encoding_layout is defined in endlines.h
+
+static inline int
+layout_unit_size(Encoding_layout layout)
+{
+    return layout == WT_1BYTE ? 1 : 2;
+}
 
 
 // BUFFERED STREAM STRUCTURE DEFINITION AND INSTANCIATION
@@ -54,48 +62,117 @@ typedef enum {
 //
 // Just be reasonable : don't try to pull from an output stream,
 // and don't try to push into an input stream.
+//
+// An input stream can also be backed by contents that are already in memory
+// (a mapped file) : fd is then NO_FD, and buffer points to the whole contents,
+// that make up one single frame.
+//
+// Streams read and write their file descriptors directly : there's no stdio buffering
+// underneath theirs. Output streams may write at an offset of their own (write_at_offset),
+// rather than at their file descriptor's position.
+//
+// Streams can also go through a buffer ring (see buffer_ring.h), whose own thread does
+// the reading or the writing : buffer then points to the ring's current buffer.
+//
+// Input streams keep track of where the current frame starts, so that the
+// position of any code-point in the stream is frame_start + its index in the buffer.
 
 
 typedef struct {
-    FILE *stream;
-    BYTE buffer[BUFFERSIZE]; // BUFFERSIZE is defined in endlines.h
-    int buf_size;
-    int buf_ptr;
+    int fd;
+    bool read_error;
+    BYTE *buffer;            // either points to an IO buffer, or to in-memory input contents
+    size_t capacity;         // size of that IO buffer
+    size_t buf_size;
+    size_t buf_ptr;
+    off_t frame_start;
     bool eof;
     Encoding_layout encoding_layout;
+    bool write_at_offset;
+    off_t write_offset;
+    Buffer_ring *ring;       // NULL, unless the stream goes through a buffer ring
 } Buffered_stream;
 
 
 // forward declarations
 static inline void read_stream_frame(Buffered_stream*);
+static inline void fill_first_frame(Buffered_stream*);
 static Encoding_layout detect_buffer_encoding_layout(Buffered_stream*);
 
 
 static inline void
-setup_base_buffered_stream(Buffered_stream *b, FILE *stream)
+setup_base_buffered_stream(Buffered_stream *b, int fd, BYTE *buffer, size_t capacity)
 {
-    b->stream = stream;
-    b->buf_size = BUFFERSIZE;
+    b->fd = fd;
+    b->read_error = false;
+    b->buffer = buffer;
+    b->capacity = capacity;
+    b->buf_size = capacity;
+    b->frame_start = 0;
     b->eof = false;
+    b->write_at_offset = false;
+    b->write_offset = 0;
+    b->ring = NULL;
+}
+
+// Input streams detect their encoding layout, unless they are told about it
+// (for instance, when they start in the middle of a file).
+static inline void
+setup_input_buffered_stream(Buffered_stream *b, int fd, BYTE *buffer, size_t capacity,
+                            Encoding_layout encoding_layout)
+{
+    setup_base_buffered_stream(b, fd, buffer, capacity);
+    b->buf_size = 0;
+    b->buf_ptr = 0;
+    read_stream_frame(b);
+    if(encoding_layout == DETECT_LAYOUT) {
+        fill_first_frame(b);
+    }
+    b->encoding_layout = encoding_layout == DETECT_LAYOUT ?
+                         detect_buffer_encoding_layout(b) : encoding_layout;
+}
+
+static inline void
+setup_in_memory_input_buffered_stream(Buffered_stream *b, const BYTE *contents, size_t size,
+                                      Encoding_layout encoding_layout)
+{
+    // never written to, as this is an input stream
+    setup_base_buffered_stream(b, NO_FD, (BYTE *)contents, size);
+    b->buf_ptr = 0;
+    b->encoding_layout = encoding_layout == DETECT_LAYOUT ?
+                         detect_buffer_encoding_layout(b) : encoding_layout;
 }
 
 static inline void
-setup_input_buffered_stream(Buffered_stream *b, FILE *stream)
+setup_ring_input_buffered_stream(Buffered_stream *b, Buffer_ring *ring,
+                                 Encoding_layout encoding_layout)
 {
-    setup_base_buffered_stream(b, stream);
-    b->buf_ptr = BUFFERSIZE;
+    setup_base_buffered_stream(b, NO_FD, NULL, 0);
+    b->ring = ring;
+    b->buf_size = 0;
+    b->buf_ptr = 0;
     read_stream_frame(b);
-    b->encoding_layout = detect_buffer_encoding_layout(b);
+    b->encoding_layout = encoding_layout == DETECT_LAYOUT ?
+                         detect_buffer_encoding_layout(b) : encoding_layout;
 }
 
 static inline void
-setup_output_buffered_stream(Buffered_stream *b, FILE *stream, Encoding_layout encoding_layout)
+setup_output_buffered_stream(Buffered_stream *b, int fd, BYTE *buffer, size_t capacity,
+                             Encoding_layout encoding_layout)
 {
-    setup_base_buffered_stream(b, stream);
+    setup_base_buffered_stream(b, fd, buffer, capacity);
     b->buf_ptr = 0;
     b->encoding_layout = encoding_layout;
 }
 
+static inline void
+setup_ring_output_buffered_stream(Buffered_stream *b, Buffer_ring *ring, size_t capacity,
+                                  Encoding_layout encoding_layout)
+{
+    setup_output_buffered_stream(b, NO_FD, next_write_buffer(ring, 0), capacity, encoding_layout);
+    b->ring = ring;
+}
+
 
 // ENCODING LAYOUT DETECTION
 // BOM based only for now
@@ -105,7 +182,7 @@ setup_output_buffered_stream(Buffered_stream *b, FILE *stream, Encoding_layout e
 static Encoding_layout
 detect_buffer_encoding_layout(Buffered_stream *b)
 {
-    if(b->buf_size >= 2) {
+    if(b->buf_size >= BOM_SIZE) {
         if(b->buffer[0] == 0xFF && b->buffer[1] == 0xFE) {
             return WT_2BYTE_LE;
         }
@@ -118,20 +195,25 @@ detect_buffer_encoding_layout(Buffered_stream *b)
 
 
 // MANAGING AN OUTPUT BUFFER
-// Pushing and flushing check the presence of an actual stream
-// b->stream is allowed to contain a null-pointer ; this is used when
+// Flushing checks the presence of an actual file descriptor
+// b->fd is allowed to be NO_FD ; this is used when
 // checking files, and lets the loop be written only once.
 
 // writing operations return true if an error occured
 static inline bool
 flush_buffer(Buffered_stream *b)
 {
-    if(b->stream) {
-        size_t nb_bytes_to_write = (size_t)b->buf_ptr;
-        size_t nb_bytes_written = fwrite(b->buffer, 1, nb_bytes_to_write, b->stream);
-        if(nb_bytes_to_write != nb_bytes_written) {
+    if(b->ring != NULL) {   // write errors are found out when finishing the ring
+        b->buffer = next_write_buffer(b->ring, b->buf_ptr);
+        b->buf_ptr = 0;
+    } else if(b->fd != NO_FD) {
+        bool written = b->write_at_offset ?
+                       write_all_at(b->fd, b->buffer, b->buf_ptr, b->write_offset) :
+                       write_all(b->fd, b->buffer, b->buf_ptr);
+        if(!written) {
             return true;
         }
+        b->write_offset += b->buf_ptr;
         b->buf_ptr = 0;
     }
     return false;
@@ -149,50 +231,69 @@ push_byte(BYTE value, Buffered_stream *b)
     return err;
 }
 
+// Bulk version of push_byte, for runs of plain text that are copied verbatim.
+static inline bool
+push_bytes(const BYTE *bytes, size_t count, Buffered_stream *b)
+{
+    while(count > 0) {
+        size_t room = b->buf_size - b->buf_ptr;
+        size_t chunk = count < room ? count : room;
+        memcpy(&(b->buffer[b->buf_ptr]), bytes, chunk);
+        b->buf_ptr += chunk;
+        bytes += chunk;
+        count -= chunk;
+        if(b->buf_ptr == b->buf_size && flush_buffer(b)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 
-// function pointer was 20% slower than a big switch
+// The encoding layout is passed explicitly, rather than read from the stream :
+// the specialized conversion loops (see below) pass it as a constant, which lets
+// the compiler drop the switch altogether.
+// Callers are responsible for not pushing into a stream that has no actual output.
 static inline bool
-push_code_point(code_point_t w, Buffered_stream *b)
+push_code_point(code_point_t w, Buffered_stream *b, Encoding_layout layout)
 {
     bool err = false;
-    if(b->stream) {
-        switch(b->encoding_layout) {
-        case WT_1BYTE:
-            err = err || push_byte( (w & 0x000000FF), b);
-            break;
-        case WT_2BYTE_LE:
-            err = err || push_byte( (w & 0x000000FF), b);
-            err = err || push_byte( ((w & 0x0000FF00) >> 8), b);
-            break;
-        case WT_2BYTE_BE:
-            err = err || push_byte( ((w & 0x0000FF00) >> 8), b);
-            err = err || push_byte( (w & 0x000000FF), b);
-            break;
-        default:
-            fprintf(stderr, "endlines : convert_stream.push_code_point called on a stream with"
-                            "an unknown encoding layout ; aborting !\n");
-            exit(EXIT_FAILURE);
-        }
+    switch(layout) {
+    case WT_1BYTE:
+        err = err || push_byte( (w & 0x000000FF), b);
+        break;
+    case WT_2BYTE_LE:
+        err = err || push_byte( (w & 0x000000FF), b);
+        err = err || push_byte( ((w & 0x0000FF00) >> 8), b);
+        break;
+    case WT_2BYTE_BE:
+        err = err || push_byte( ((w & 0x0000FF00) >> 8), b);
+        err = err || push_byte( (w & 0x000000FF), b);
+        break;
+    default:
+        fprintf(stderr, "endlines : convert_stream.push_code_point called on a stream with"
+                        "an unknown encoding layout ; aborting !\n");
+        exit(EXIT_FAILURE);
     }
     return err;
 }
 
 static inline bool
-push_newline(Convention convention, Buffered_stream *b)
+push_newline(Convention convention, Buffered_stream *b, Encoding_layout layout)
 {
     bool err = false;
     switch(convention) {
     case NO_CONVENTION:
         break;
     case CR:
-        err = err || push_code_point(13, b);
+        err = err || push_code_point(13, b, layout);
         break;
     case LF:
-        err = err || push_code_point(10, b);
+        err = err || push_code_point(10, b, layout);
         break;
     case CRLF:
-        err = err || push_code_point(13, b);
-        err = err || push_code_point(10, b);
+        err = err || push_code_point(13, b, layout);
+        err = err || push_code_point(10, b, layout);
         break;
     default:
         fprintf(stderr, "endlines : convert_stream.push_newline called with an unknown convention ; aborting !\n");
@@ -202,18 +303,70 @@ push_newline(Convention convention, Buffered_stream *b)
 }
 
 
+size_t
+encode_newline(Convention convention, Encoding_layout layout, BYTE *destination)
+{
+    Buffered_stream b;
+    setup_output_buffered_stream(&b, NO_FD, destination, MAX_NEWLINE_SIZE, layout);
+    push_newline(convention, &b, layout);
+    return b.buf_ptr;
+}
+
+
 
 // MANAGING AN INPUT BUFFER
 
+// Precondition : the current frame has been entirely consumed.
+// In-memory contents come as one single frame : there is nothing more to read after it.
 static inline void
 read_stream_frame(Buffered_stream *b)
 {
-    b->buf_size = fread(b->buffer, 1, BUFFERSIZE, b->stream);
-    if(b->buf_size == 0) {
+    b->frame_start += (off_t)b->buf_size;
+    b->buf_ptr = 0;
+    b->buf_size = 0;
+    if(b->ring != NULL) {   // read errors are found out when finishing the ring
+        b->buffer = next_read_buffer(b->ring, &(b->buf_size));
+        b->eof = (b->buf_size == 0);
+        return;
+    }
+    if(b->fd == NO_FD) {
         b->eof = true;
         return;
     }
-    b->buf_ptr = 0;
+    ssize_t got;
+    do {
+        got = read(b->fd, b->buffer, b->capacity);
+    } while(got < 0 && errno == EINTR);
+    if(got <= 0) {
+        b->read_error = got < 0;
+        b->eof = true;
+        return;
+    }
+    b->buf_size = (size_t)got;
+}
+
+// A pipe may hand out fewer bytes than a BOM at once : the first frame gets read into
+// until it holds a whole one, or the stream ends, so that the layout can be told from it.
+static inline void
+fill_first_frame(Buffered_stream *b)
+{
+    while(b->buf_size > 0 && b->buf_size < BOM_SIZE) {
+        ssize_t got = read(b->fd, b->buffer + b->buf_size, b->capacity - b->buf_size);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {   // the end of the stream, or the error, comes up again at the next frame
+            return;
+        }
+        b->buf_size += (size_t)got;
+    }
+}
+
+// Position in the stream of the next byte to be pulled.
+static inline off_t
+stream_position(Buffered_stream *b)
+{
+    return b->frame_start + (off_t)b->buf_ptr;
 }
 
 static inline BYTE
@@ -230,12 +383,12 @@ pull_byte(Buffered_stream *b)
     }
 }
 
-// again, function pointer was 20% slower than a big switch
+// Same as push_code_point : the layout is a parameter, so that it can be a constant.
 static inline code_point_t
-pull_code_point(Buffered_stream *b)
+pull_code_point(Buffered_stream *b, Encoding_layout layout)
 {
     code_point_t b1, b2, w;
-    switch(b->encoding_layout) {
+    switch(layout) {
     case WT_1BYTE:
         return (code_point_t) pull_byte(b);
     case WT_2BYTE_LE:
@@ -264,6 +417,45 @@ is_non_text_code(code_point_t w)
 }
 
 
+// SKIPPING OVER PLAIN TEXT
+// Copies in one go whatever is left in the input frame up to the next code-point
+// that needs individual attention (see scan_kernels.h).
+// Code units are copied verbatim, as the output uses the same layout as the input.
+// For 16 bit layouts, only whole code units are taken : a unit that straddles two
+// frames is left to pull_code_point.
+// When writing, a run is capped to the room left in the output buffer, so that
+// scanning and copying a large in-memory input proceed together, while the data is in cache.
+// The run length is stored into *run_length. If writes is false, the run is only skipped over.
+// Returns true if an error occured while writing.
+
+static inline bool
+copy_plain_text_run(Buffered_stream *in, Buffered_stream *out, bool writes, Encoding_layout layout,
+                    size_t *run_length)
+{
+    *run_length = 0;
+    if(in->buf_ptr >= in->buf_size) {
+        return false;
+    }
+    const BYTE *run_start = &(in->buffer[in->buf_ptr]);
+    size_t available = in->buf_size - in->buf_ptr;
+    if(writes && available > out->buf_size - out->buf_ptr) {
+        available = out->buf_size - out->buf_ptr;
+    }
+    if(layout == WT_1BYTE) {
+        *run_length = find_next_special_byte(run_start, available);
+    } else {
+        *run_length = 2 * find_next_special_unit(run_start, available / 2, layout == WT_2BYTE_BE);
+    }
+    if(*run_length > 0) {
+        if(writes && push_bytes(run_start, *run_length, out)) {
+            return true;
+        }
+        in->buf_ptr += *run_length;
+    }
+    return false;
+}
+
+
 
 
 
@@ -274,99 +466,397 @@ init_report(Conversion_Report *report)
 {
     report->error_during_conversion = false;
     report->contains_non_text_chars = false;
+    report->stopped_at_nonconforming_eol = false;
+    report->conforming_prefix_length = 0;
     for(int i=0; i<CONVENTIONS_COUNT; i++) {
         report->count_by_convention[i] = 0;
     }
 }
 
-Conversion_Report
-convert_stream(Conversion_Parameters p)
+// With interrupt_if_not_like_dst_convention, the scan stops right when it becomes
+// sure that the line ending starting at offset is not in the destination convention.
+// That line ending is left out of the counts : they only account for the conforming prefix.
+static inline void
+stop_at_nonconforming_eol(Conversion_Report *report, off_t offset)
 {
-    bool err = false; // set to true as soon as an IO error has been detected
-                      // Thus its clumsy (though innocent) presence before many function calls.
-
-    Buffered_stream input_stream;
-    setup_input_buffered_stream(&input_stream, p.instream);
+    report->stopped_at_nonconforming_eol = true;
+    report->conforming_prefix_length = offset;
+}
 
-    Buffered_stream output_stream;
-    setup_output_buffered_stream(&output_stream, p.outstream, input_stream.encoding_layout);
 
-    Conversion_Report report;
-    init_report(&report);
+// The loop itself is written once, as a macro template, and instanciated
+// for every combination of :
+//    - the encoding layout of the input (see Encoding_layout),
+//    - the destination convention,
+//    - whether there is an output stream at all (WRITE_OUTPUT), or not (SCAN_ONLY).
+//
+// Each instance thus runs without any per code-point dispatch on these parameters :
+// the compiler folds all the switches in pull_code_point, push_code_point and push_newline.
+// convert_stream picks the right instance once, at entry (see conversion_loops below).
+//
+// An instance returns true if an IO error occured, and leaves its findings in the report.
+// last_was_13 and last_was_newline tell whether the latest code-point was 13, resp. either 13 or 10.
+// They are in-out parameters : the loop can take over a stream that has already been partly scanned.
+
+#define WRITE_OUTPUT true
+#define SCAN_ONLY    false
+
+typedef bool (*Conversion_loop)(Buffered_stream *in, Buffered_stream *out,
+                                Conversion_Parameters *p, Conversion_Report *report,
+                                bool *last_was_13, bool *last_was_newline);
+
+#define DEFINE_CONVERSION_LOOP(LAYOUT, DST, WRITES) \
+static bool \
+conversion_loop_##LAYOUT##_##DST##_##WRITES(Buffered_stream *in, Buffered_stream *out, \
+                                            Conversion_Parameters *p, Conversion_Report *report, \
+                                            bool *p_last_was_13, bool *p_last_was_newline) \
+{ \
+    const off_t UNIT = layout_unit_size(LAYOUT); \
+    bool err = false;               /* set to true as soon as an IO error has been detected */ \
+    code_point_t code_point;        /* the latest code-point we've read */ \
+    bool last_was_13 = *p_last_was_13; \
+    bool last_was_newline = *p_last_was_newline; \
+ \
+    while(true) { \
+        size_t run_length; \
+        if(copy_plain_text_run(in, out, WRITES, LAYOUT, &run_length)) { \
+            err = true; \
+            break; \
+        } \
+        if(run_length > 0) { \
+            if(last_was_13 && DST == CRLF && p->interrupt_if_not_like_dst_convention) { \
+                -- report->count_by_convention[CR];  /* the previous 13 was a lone CR */ \
+                stop_at_nonconforming_eol(report, stream_position(in) - (off_t)run_length - UNIT); \
+                break; \
+            } \
+            last_was_13 = false; \
+            last_was_newline = false; \
+        } \
+        code_point = pull_code_point(in, LAYOUT); \
+ \
+        /* Is this next code-point... */ \
+ \
+        /* ... a special case ? */ \
+        if(in->eof) { \
+            break; \
+        } \
+        if(is_non_text_code(code_point)) { \
+            last_was_newline = false; \
+            report->contains_non_text_chars = true; \
+            if(p->interrupt_if_non_text) { \
+                break; \
+            } \
+        } \
+ \
+        /* ... a line terminator ? */ \
+        /* Offsets are only needed when looking out for non conforming line endings : */ \
+        /* the current code-point starts one unit before the stream position, */ \
+        /* and a 13 we've just met, two units before. */ \
+        if(code_point == 13) {   /* 13 can be a CR new-line, or the beginning of a CR-LF new-line */ \
+            if(p->interrupt_if_not_like_dst_convention) { \
+                if(last_was_13 && DST == CRLF) {  /* the previous 13 was a lone CR */ \
+                    -- report->count_by_convention[CR]; \
+                    stop_at_nonconforming_eol(report, stream_position(in) - 2*UNIT); \
+                    break; \
+                } \
+                if(DST != CR && DST != CRLF) { \
+                    stop_at_nonconforming_eol(report, stream_position(in) - UNIT); \
+                    break; \
+                } \
+            } \
+            if(WRITES) { \
+                err = push_newline(DST, out, LAYOUT); \
+            } \
+            ++ report->count_by_convention[CR];  /* may be cancelled by a LF coming up right next */ \
+            last_was_13 = true; \
+            last_was_newline = true; \
+ \
+        } else if(code_point == 10) {  /* 10 can be a lone LF or the end of a CR-LF */ \
+            if(last_was_13) {  /* so we just met the end of a CR-LF */ \
+                -- report->count_by_convention[CR]; \
+                if(p->interrupt_if_not_like_dst_convention && DST != CRLF) { \
+                    stop_at_nonconforming_eol(report, stream_position(in) - 2*UNIT); \
+                    break; \
+                } \
+                ++ report->count_by_convention[CRLF]; \
+                last_was_newline = true; \
+            } else {           /* we met a lone LF */ \
+                if(p->interrupt_if_not_like_dst_convention && DST != LF) { \
+                    stop_at_nonconforming_eol(report, stream_position(in) - UNIT); \
+                    break; \
+                } \
+                if(WRITES) { \
+                    err = push_newline(DST, out, LAYOUT); \
+                } \
+                last_was_newline = true; \
+                ++ report->count_by_convention[LF]; \
+            } \
+            last_was_13 = false; \
+ \
+        /* ... or just a regular character ? */ \
+        } else { \
+            if(last_was_13 && DST == CRLF && p->interrupt_if_not_like_dst_convention) { \
+                -- report->count_by_convention[CR];  /* the previous 13 was a lone CR */ \
+                stop_at_nonconforming_eol(report, stream_position(in) - 2*UNIT); \
+                break; \
+            } \
+            if(WRITES) { \
+                err = push_code_point(code_point, out, LAYOUT); \
+            } \
+            last_was_13 = false; \
+            last_was_newline = false; \
+        } \
+        if(err) { \
+            break; \
+        } \
+    } \
+    *p_last_was_13 = last_was_13; \
+    *p_last_was_newline = last_was_newline; \
+    return err; \
+}
 
-    code_point_t code_point;        // the latest code-point we've read
-    bool last_was_13 = false;       // if the latest code-point we've read was 13
-    bool last_was_newline = false;  // if the latest was either 13 or 10
 
-    while(true) {
-        code_point = pull_code_point(&input_stream);
+// Instanciation, and lookup table : conversion_loops[layout][destination convention][writes]
+// Only the first four conventions can be destinations ; MIXED can not.
+
+#define DESTINATION_CONVENTIONS_COUNT 4
+
+#define CONVERSION_LOOPS_FOR_LAYOUT(LAYOUT) \
+    X(LAYOUT, NO_CONVENTION) \
+    X(LAYOUT, CR) \
+    X(LAYOUT, LF) \
+    X(LAYOUT, CRLF)
+
+// The table has an (unused) row for DETECT_LAYOUT : the layout is always known by the time a loop is picked.
+#define CONVERSION_LOOPS_TABLE \
+    CONVERSION_LOOPS_FOR_LAYOUT(WT_1BYTE) \
+    CONVERSION_LOOPS_FOR_LAYOUT(WT_2BYTE_LE) \
+    CONVERSION_LOOPS_FOR_LAYOUT(WT_2BYTE_BE)
+
+#define X(LAYOUT, DST) \
+    DEFINE_CONVERSION_LOOP(LAYOUT, DST, WRITE_OUTPUT) \
+    DEFINE_CONVERSION_LOOP(LAYOUT, DST, SCAN_ONLY)
+CONVERSION_LOOPS_TABLE
+#undef X
+
+#define X(LAYOUT, DST) \
+    [LAYOUT][DST] = { \
+        [SCAN_ONLY]    = conversion_loop_##LAYOUT##_##DST##_SCAN_ONLY, \
+        [WRITE_OUTPUT] = conversion_loop_##LAYOUT##_##DST##_WRITE_OUTPUT \
+    },
+static const Conversion_loop conversion_loops[ENCODING_LAYOUTS_COUNT][DESTINATION_CONVENTIONS_COUNT][2] = {
+    CONVERSION_LOOPS_TABLE
+};
+#undef X
+
+
+// COUNT-ONLY ENGINE
+// When nothing is to be written, single byte streams don't need to go through the
+// conversion loop : line endings can be counted a whole block at a time, out of the
+// masks given by classify_byte_block (see scan_kernels.h).
+//
+// The engine shares its state with the conversion loop. It stops at the start of any
+// block that would make the loop interrupt (see the interrupt_if_* parameters), and
+// the conversion loop then takes over from there, so that interruptions happen at
+// the very same code-point.
+// Returns true if the whole stream has been consumed, false if the loop has to take over.
+
+// Tells whether a block holds a line ending that is not in the destination convention,
+// including a 13 right at the end of the previous block, that turns out to be a lone CR.
+// A 13 in the last byte of this block is left for the next block to decide upon.
+static inline bool
+has_nonconforming_eol(Byte_block_masks *m, uint64_t lone_lfs, uint64_t last_byte_bit,
+                      bool last_was_13, Convention dst_convention)
+{
+    uint64_t lone_crs;
+    switch(dst_convention) {
+    case LF:
+        return m->cr;
+    case CR:
+        return m->lf;
+    case CRLF:
+        lone_crs = m->cr & ~(m->lf >> 1) & ~last_byte_bit;
+        return lone_crs || lone_lfs || (last_was_13 && !(m->lf & 1));
+    default:
+        return m->cr || m->lf;
+    }
+}
 
+static bool
+count_line_endings(Buffered_stream *in, Conversion_Parameters *p, Conversion_Report *report,
+                   bool *last_was_13, bool *last_was_newline)
+{
+    BYTE padded_block[BYTE_BLOCK_SIZE];
+    Byte_block_masks m;
 
-        // Is this next code-point...
-        
-        // ... a special case ?
-        if(input_stream.eof) {
-            break;
-        }
-        if(is_non_text_code(code_point)) {
-            last_was_newline = false;
-            report.contains_non_text_chars = true;
-            if(p.interrupt_if_non_text) {
-                break;
+    while(true) {
+        while(in->buf_ptr < in->buf_size) {
+            const BYTE *block = &(in->buffer[in->buf_ptr]);
+            size_t block_length = in->buf_size - in->buf_ptr;
+            if(block_length >= BYTE_BLOCK_SIZE) {
+                block_length = BYTE_BLOCK_SIZE;
+            } else {  // the tail of the frame gets padded with plain spaces
+                memcpy(padded_block, block, block_length);
+                memset(&(padded_block[block_length]), ' ', BYTE_BLOCK_SIZE - block_length);
+                block = padded_block;
             }
-        }
-
-        // ... a line terminator ? 
-        if(code_point == 13) {   // 13 can be a CR new-line, or the beginning of a CR-LF new-line
-            err = push_newline(p.dst_convention, &output_stream);
-            ++ report.count_by_convention[CR];  // may be cancelled by a LF coming up right next
-            last_was_13 = true;
-            last_was_newline = true;
-
-        } else if(code_point == 10) {  // 10 can be a lone LF or the end of a CR-LF
-            if(last_was_13) {  // so we just met the end of a CR-LF
-                -- report.count_by_convention[CR];
-                ++ report.count_by_convention[CRLF];
-                last_was_newline = true;
-                if(p.interrupt_if_not_like_dst_convention && p.dst_convention != CRLF) {
-                    break;
-                }
-            } else {           // we met a lone LF
-                err = push_newline(p.dst_convention, &output_stream);
-                last_was_newline = true;
-                ++ report.count_by_convention[LF];
-                if(p.interrupt_if_not_like_dst_convention && p.dst_convention != LF) {
-                    break;
+            classify_byte_block(block, &m);
+
+            uint64_t after_13 = (m.cr << 1) | (*last_was_13 ? 1 : 0);
+            uint64_t crlf_ends = m.lf & after_13;
+            uint64_t lone_lfs = m.lf & ~after_13;
+            if(m.special & ~(m.cr | m.lf)) {
+                if(p->interrupt_if_non_text) {
+                    return false;
                 }
+                report->contains_non_text_chars = true;
+            }
+            uint64_t last_byte_bit = (uint64_t)1 << (block_length - 1);
+            if(p->interrupt_if_not_like_dst_convention &&
+               has_nonconforming_eol(&m, lone_lfs, last_byte_bit, *last_was_13, p->dst_convention)) {
+                return false;
             }
-            last_was_13 = false;
 
+            // Same arithmetic as the conversion loop : every 13 counts as a CR,
+            // until a 10 coming up right next turns it into a CR-LF.
+            report->count_by_convention[CR] += count_set_bits_64(m.cr) - count_set_bits_64(crlf_ends);
+            report->count_by_convention[CRLF] += count_set_bits_64(crlf_ends);
+            report->count_by_convention[LF] += count_set_bits_64(lone_lfs);
 
-        // ... or just a regular character ?
-        } else {
-            err = push_code_point(code_point, &output_stream);
-            last_was_13 = false;
-            last_was_newline = false;
+            *last_was_13 = (m.cr & last_byte_bit) != 0;
+            *last_was_newline = ((m.cr | m.lf) & last_byte_bit) != 0;
+            in->buf_ptr += block_length;
         }
-        if(err) {
-            break;
+        read_stream_frame(in);
+        if(in->eof) {
+            return true;
         }
     }
+}
+
+
+
+// IO BUFFERS
+// Page aligned, so that reads and writes of whole blocks don't straddle more pages than needed.
+// Large ones are advised to be backed by huge pages : fewer TLB misses while scanning them.
+
+static BYTE *
+allocate_io_buffer(size_t size)
+{
+    void *buffer = NULL;
+    long page_size = sysconf(_SC_PAGESIZE);
+    if(posix_memalign(&buffer, page_size > 0 ? (size_t)page_size : 4096, size)) {
+        fprintf(stderr, "%s : can't allocate memory\n", PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+    }
+#ifdef MADV_HUGEPAGE
+    if(size >= MIN_HUGE_PAGE_BUFFER_SIZE) {
+        madvise(buffer, size, MADV_HUGEPAGE);
+    }
+#endif
+    return buffer;
+}
+
+
+
+Conversion_Report
+convert_stream(Conversion_Parameters p)
+{
+    size_t buffer_size = p.buffer_size ? p.buffer_size : BUFFERSIZE;
+
+    Buffer_ring *reading_ring = NULL;
+    Buffer_ring *writing_ring = NULL;
+    if(p.pipelined) {
+        reading_ring = p.in_memory ? NULL : new_reading_ring(p.in_fd, buffer_size);
+        writing_ring = p.out_fd == NO_FD ? NULL : new_writing_ring(p.out_fd, buffer_size);
+    }
+
+    Buffered_stream input_stream;
+    BYTE *input_buffer = NULL;
+    if(p.in_memory) {
+        setup_in_memory_input_buffered_stream(&input_stream, p.in_memory, p.in_memory_size,
+                                              p.encoding_layout);
+    } else if(reading_ring) {
+        setup_ring_input_buffered_stream(&input_stream, reading_ring, p.encoding_layout);
+    } else {
+        input_buffer = allocate_io_buffer(buffer_size);
+        setup_input_buffered_stream(&input_stream, p.in_fd, input_buffer, buffer_size,
+                                    p.encoding_layout);
+    }
+
+    Buffered_stream output_stream;
+    BYTE *output_buffer = NULL;
+    if(writing_ring) {
+        setup_ring_output_buffered_stream(&output_stream, writing_ring, buffer_size,
+                                          input_stream.encoding_layout);
+    } else {
+        output_buffer = p.out_fd != NO_FD ? allocate_io_buffer(buffer_size) : NULL;
+        setup_output_buffered_stream(&output_stream, p.out_fd, output_buffer, buffer_size,
+                                     input_stream.encoding_layout);
+    }
+    output_stream.write_at_offset = p.write_at_offset;
+    output_stream.write_offset = p.out_offset;
+
+    Conversion_Report report;
+    init_report(&report);
+    report.encoding_layout = input_stream.encoding_layout;
+
+    if((int)p.dst_convention < 0 || (int)p.dst_convention >= DESTINATION_CONVENTIONS_COUNT) {
+        fprintf(stderr, "endlines : convert_stream called with an unknown destination convention ; aborting !\n");
+        exit(EXIT_FAILURE);
+    }
+    bool writes = (p.out_fd != NO_FD);
+    Conversion_loop loop = conversion_loops[input_stream.encoding_layout][p.dst_convention][writes];
+
+    bool last_was_13 = false;
+    bool last_was_newline = false;
+    bool err = false;
+    bool whole_stream_counted = false;
+    if(!writes && input_stream.encoding_layout == WT_1BYTE) {
+        whole_stream_counted = count_line_endings(&input_stream, &p, &report, &last_was_13, &last_was_newline);
+    }
+    if(!whole_stream_counted) {
+        err = loop(&input_stream, &output_stream, &p, &report, &last_was_13, &last_was_newline);
+    }
 
 
     // Looping across the stream is over.
     // Finish and return.
 
+    if(input_stream.eof) {
+        // Stray bytes after the last whole code unit are not part of the conforming prefix.
+        // A 13 at the very end is a lone CR, that's not in CR-LF.
+        off_t unit = layout_unit_size(input_stream.encoding_layout);
+        off_t end = stream_position(&input_stream);
+        end -= end % unit;
+        if(p.interrupt_if_not_like_dst_convention && p.dst_convention == CRLF && last_was_13) {
+            -- report.count_by_convention[CR];
+            stop_at_nonconforming_eol(&report, end - unit);
+        } else {
+            report.conforming_prefix_length = end;
+        }
+    }
+
     report.has_final_eol = last_was_newline;
     if(p.final_char_has_to_be_eol && !last_was_newline) {
-        err = err || push_newline(p.dst_convention, &output_stream);
-	report.has_final_eol = true;
+        if(writes) {
+            err = err || push_newline(p.dst_convention, &output_stream, output_stream.encoding_layout);
+        }
+        report.has_final_eol = true;
     }
     err = err || flush_buffer(&output_stream);
 
-    if(ferror(p.instream)) {
+    if(input_stream.read_error) {
+        err = true;
+    }
+    if(writing_ring && !finish_buffer_ring(writing_ring)) {
+        err = true;
+    }
+    if(reading_ring && !finish_buffer_ring(reading_ring)) {
         err = true;
     }
+    free(input_buffer);
+    free(output_buffer);
     report.error_during_conversion = err;
     return report;
 }
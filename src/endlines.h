@@ -28,13 +28,35 @@
 #define TMP_FILENAME_BASE ".tmp_endlines_"
 
 // Size of buffer in bytes, for buffered file reading / writing
+// That's the smallest one : buffer sizes can be picked per file (see io_buffer_size),
+// or set with --buffer-size, up to MAX_BUFFER_SIZE.
 #define BUFFERSIZE 16384
+#define MAX_BUFFER_SIZE (256*1024*1024)
+
+// Largest buffer size that gets picked for a file without --buffer-size.
+#define MAX_DEFAULT_BUFFER_SIZE (1024*1024)
+
+// Buffers of this size or more are advised to be backed by huge pages, where available.
+#define MIN_HUGE_PAGE_BUFFER_SIZE (2*1024*1024)
+
+// Files smaller than this are read through their stream rather than mapped in memory :
+// a couple of reads cost less than setting up and tearing down a mapping.
+#define MIN_MAPPED_FILE_SIZE (4*BUFFERSIZE)
+
+// Mapped files up to this size are read ahead all at once (MAP_POPULATE, where available).
+// Larger ones are left to the kernel's sequential read-ahead, so as not to pin them in memory.
+#define MAX_POPULATED_MAPPING_SIZE (64*1024*1024)
+
+// With --jobs, mapped files are converted by several threads at once, each taking a chunk
+// of at least this size.
+#define MIN_PARALLEL_CHUNK_SIZE (16*1024*1024)
 
 
 // Basic includes for things that are used all across the source code
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <utime.h>
 
 #ifndef BYTE
@@ -79,6 +101,26 @@ typedef enum {
 
 
 
+// How code-points are laid out in a stream : 8 bit, 16 bit little-endian, or 16 bit big-endian.
+// UTF-8 and all single byte codesets are read as 8 bit.
+// DETECT_LAYOUT asks for the layout to be found out from the stream's BOM.
+
+#define ENCODING_LAYOUTS_COUNT 4
+typedef enum {
+    DETECT_LAYOUT,
+    WT_1BYTE,
+    WT_2BYTE_LE,
+    WT_2BYTE_BE
+} Encoding_layout;
+
+// Number of bytes at the start of a stream that its layout is told from.
+#define BOM_SIZE 2
+
+
+
+
+
+
 // file_operations.c : our functions for manipulating files
 
 // Checks that we'll be allowed to write inside a file.
@@ -86,14 +128,31 @@ typedef enum {
 FileOp_Status check_write_access(char *filename);
 
 
+// Files are handled through raw file descriptors : convert_stream does its own buffering.
+
 // Open a file in write mode.
 // Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
-FileOp_Status open_to_write(FILE **out, char *tmp_filename);
+FileOp_Status open_to_write(int *out, char *tmp_filename);
 
 
-// Open a file in read mode.
+// Open a file in read mode, with a hint that it will be read sequentially.
 // Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
-FileOp_Status open_to_read(FILE **in,  char *in_filename);
+FileOp_Status open_to_read(int *in,  char *in_filename);
+
+
+// Close an input file, advising the kernel that its cached pages won't be needed anymore :
+// going through a whole tree shouldn't evict everything else from the page cache.
+// (Not worth it on outputs : their pages are still dirty, and it would only force writeback.)
+// Returns close's result.
+int close_dropping_cache(int fd);
+
+
+// Write all count bytes, however many write calls it takes.
+// Returns true upon success.
+bool write_all(int fd, const BYTE *bytes, size_t count);
+
+// The same, at offset in the file, leaving fd's own position alone (through pwrite).
+bool write_all_at(int fd, const BYTE *bytes, size_t count, off_t offset);
 
 
 // Deletes filename, then moves tmp_filename in the place of filename.
@@ -120,6 +179,59 @@ FileOp_Status make_filename_in_same_location(char *reference_name_and_path, char
 struct utimbuf get_file_times(struct stat *statinfo);
 
 
+// The whole contents of an input file, mapped in memory.
+typedef struct {
+    BYTE *contents;
+    size_t size;
+} Input_mapping;
+
+// Map an opened regular file in memory, read-only, with a hint that it will be read sequentially.
+// Returns true upon success. Returns false if the file can not, or should not, be
+// mapped (too small, not a regular file, mapping refused...) : this is not an error,
+// mapping->contents is then NULL, and the caller should simply read the file.
+// The mapping's size is the file's as it is once opened : it may have changed since it was
+// walked, and pages past its end can't be touched.
+bool map_to_read(int in, Input_mapping *mapping);
+
+// Release a mapping made by map_to_read. Does nothing if the file was not mapped.
+void unmap_input(Input_mapping *mapping);
+
+
+// Position an input file at offset, unless it is read through its mapping.
+// Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
+FileOp_Status seek_input(int in, Input_mapping *mapping, off_t offset, char *filename);
+
+
+// Open an existing file to overwrite it in place, from offset on.
+// Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
+FileOp_Status open_to_overwrite(int *out, char *filename, off_t offset);
+
+
+// Close a file opened by open_to_overwrite, after truncating it right where the writing ended.
+// Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
+FileOp_Status close_overwritten_file(int out, char *filename);
+
+
+// Picks the size of the buffers that convert_stream should use for a file or stream :
+// requested_size if it isn't 0, otherwise a default that grows with the file (see
+// MAX_DEFAULT_BUFFER_SIZE) in whole blocks of its file system, or the capacity of a pipe.
+size_t io_buffer_size(int fd, struct stat *statinfo, size_t requested_size);
+
+
+// Append count bytes at the end of a file, through a file descriptor opened with O_APPEND.
+// Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
+FileOp_Status append_to_file(char *filename, const BYTE *bytes, size_t count);
+
+
+// Copy the first length bytes of an input file into out : within the kernel where
+// copy_file_range is available, and for what's left, straight from the input's mapping if it
+// has one, otherwise by reading it, and it is then left positioned right after them.
+// in may be NO_FD if the mapping holds the whole contents.
+// Returns CAN_CONTINUE upon success, FILEOP_ERROR upon failure.
+FileOp_Status copy_input_prefix(int in, Input_mapping *mapping, off_t length,
+                                int out, char *filename);
+
+
 
 
 
@@ -129,16 +241,30 @@ struct utimbuf get_file_times(struct stat *statinfo);
 
 // convert_stream's calling signature structure :
 
+#define NO_FD (-1)
+
 typedef struct {
-    FILE *instream;              // stream whose content will be converted
-    FILE *outstream;             // stream into which to write the converted contents
-                                 // (outstream can be NULL)
+    int in_fd;                   // file descriptor whose content will be converted
+    const BYTE *in_memory;       // alternatively, if not NULL : the whole contents to convert,
+    size_t in_memory_size;       //   already in memory (typically an Input_mapping) ;
+                                 //   in_fd is then left unused
+    Encoding_layout encoding_layout;  // layout of the input ; DETECT_LAYOUT (the default) to find
+                                      // out from its BOM. Needed when the input starts mid-file.
+    int out_fd;                  // file descriptor into which to write the converted contents
+                                 // (NO_FD to write nothing ; beware that 0 is stdin)
+    bool write_at_offset;        // if true, write from out_offset on, rather than at out_fd's
+    off_t out_offset;            //   current position, which is then left alone : several
+                                 //   conversions can then write to the same file at once
     Convention dst_convention;   // convention into which to convert
     bool interrupt_if_not_like_dst_convention;  // return prematurely if the input contents
                                                 // use a different convention than our destination convention
     bool interrupt_if_non_text;        // return prematurely if the input contents contain
                                        // non-text characters
     bool final_char_has_to_be_eol;  // add a final end-of-line marker if there's none
+    size_t buffer_size;          // size of the reading and writing buffers ; 0 for BUFFERSIZE
+    bool pipelined;              // read in_fd and write out_fd on threads of their own, so that
+                                 // IO and conversion overlap (see buffer_ring.h). in_fd is then
+                                 // always read up to its end, even if the conversion stops early.
 } Conversion_Parameters;
 
 
@@ -155,25 +281,101 @@ typedef struct {
     bool contains_non_text_chars;  // true if the input contents contained non-text characters
     bool has_final_eol;            // true if either the original file had a final EOL,
                                    //   or the conversion process added one
+
+    Encoding_layout encoding_layout;  // the layout the input was read with
+
+    bool stopped_at_nonconforming_eol;  // true if interrupt_if_not_like_dst_convention made the scan
+                                        //   stop, at the first line ending not in dst_convention.
+                                        //   count_by_convention then leaves that line ending out.
+    off_t conforming_prefix_length;     // number of bytes, from the start of the input, that are known
+                                        //   to need no conversion : everything before the line ending
+                                        //   the scan stopped at, or the whole input if it was read to its end.
 } Conversion_Report;
 
 
 Conversion_Report convert_stream(Conversion_Parameters p);
 
 
+// Writes into destination the line ending of a convention, as encoded in a layout
+// (which may not be DETECT_LAYOUT). Returns its size in bytes, never more than MAX_NEWLINE_SIZE.
+#define MAX_NEWLINE_SIZE 4
+size_t encode_newline(Convention convention, Encoding_layout layout, BYTE *destination);
+
+
+
+
+// parallel_conversion.c
+
+
+// The same as convert_stream, using up to thread_count threads for inputs that are in memory,
+// in the WT_1BYTE layout, and written to a file that can be seeked.
+// The input is split into chunks of at least MIN_PARALLEL_CHUNK_SIZE, that never split a CR-LF.
+// The line endings of all chunks are counted at once, which tells where each chunk's output
+// goes in the file ; then all chunks are converted at once, each written at its own offset.
+// Other inputs are left to convert_stream.
+Conversion_Report convert_stream_in_parallel(Conversion_Parameters p, int thread_count);
+
+
+
+
+// splice_passthrough.c
+
+
+// The same as convert_stream, for an input pipe that's written to a pipe or a regular file.
+// As long as the input's line endings are in dst_convention already, it's forwarded to the
+// output by the kernel (Linux's tee and splice), without being copied there by hand.
+// From the first line ending that needs converting on, the rest goes through convert_stream.
+// Other inputs, and systems without splice, are left to convert_stream.
+Conversion_Report convert_stream_spliced(Conversion_Parameters p);
+
+
+
+
+// binary_sniffing.c
+
+
+// Number of bytes at the start of a file that binary sniffing looks at.
+#define SNIFFED_HEAD_SIZE 4096
+
+// returns true if the first size bytes of a file tell that it's binary, so that it can
+// be skipped without being read any further : they start with the signature of a common
+// binary format (ELF, zip, gzip, png, sqlite, parquet...), or, unless they start with a
+// UTF-16 BOM, they hold a non text character.
+bool looks_like_binary_head(const BYTE *head, size_t size);
+
+// the same, for the first SNIFFED_HEAD_SIZE bytes of an opened file, taken from its
+// mapping if it's mapped, or read from in otherwise, without moving its position.
+// A file that can't be read doesn't look binary : the reads that follow will tell.
+bool sniffs_as_binary(int in, Input_mapping *mapping);
+
+
 
 
 // utils.c
 
 
 // returns true if filename ends with an extension that typically belongs to binary files
-// (such as "picture.png" or "payroll.xls")
+// (such as "picture.png" or "payroll.xls"), whatever its case
 bool has_known_binary_file_extension(char* filename); 
+
+// Extensions longer than that are never known binary extensions.
+#define MAX_BINARY_EXTENSION_LENGTH 15
+
+// adds the extensions listed in the given file, one per line, to the ones that
+// has_known_binary_file_extension knows of. A leading dot is allowed ; blank lines and
+// lines starting with # are ignored. Returns false if the file can't be read, or one
+// of its extensions is too long or too many. Not to be called while files are being processed.
+bool load_known_binary_file_extensions(const char* filename);
                                                             
 
 // from a report produced by convert_stream, returns the type of convention that was used
 // in the file or stream that matches this report (including NO_CONVENTION or MIXED)
 Convention get_source_convention(Conversion_Report* report); 
+
+
+// folds into report the findings of following_report, that is about the contents
+// that come right after the ones report is about
+void append_report(Conversion_Report *report, Conversion_Report *following_report);
                                                              
 
 void display_help_and_quit();
@@ -16,13 +16,23 @@
    limitations under the License.
 */
 
+// for MAP_POPULATE and madvise, and copy_file_range on Linux
+#define _GNU_SOURCE
+
 #include "endlines.h"
 #include "walkers.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAS_COPY_FILE_RANGE
+#endif
+
 
 // SEE endlines.h FOR INTERFACE DOCUMENTATION
 
@@ -49,22 +59,25 @@ check_write_access(char *filename)
 
 
 FileOp_Status
-open_to_read(FILE **in, char *in_filename)
+open_to_read(int *in, char *in_filename)
 {
-    *in = fopen(in_filename, "rb");
-    if(*in == NULL) {
+    *in = open(in_filename, O_RDONLY);
+    if(*in < 0) {
         fprintf(stdout, "%s : can not read %s\n", PROGRAM_NAME, in_filename);
         return FILEOP_ERROR;
     }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(*in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
     return CAN_CONTINUE;
 }
 
 
 FileOp_Status
-open_to_write(FILE **out, char *tmp_filename)
+open_to_write(int *out, char *tmp_filename)
 {
-    *out = fopen(tmp_filename, "wb");
-    if(*out == NULL) {
+    *out = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(*out < 0) {
         fprintf(stdout, "%s : can not create %s\n", PROGRAM_NAME, tmp_filename);
         return FILEOP_ERROR;
     }
@@ -72,6 +85,53 @@ open_to_write(FILE **out, char *tmp_filename)
 }
 
 
+int
+close_dropping_cache(int fd)
+{
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    return close(fd);
+}
+
+
+bool
+write_all(int fd, const BYTE *bytes, size_t count)
+{
+    while(count > 0) {
+        ssize_t written = write(fd, bytes, count);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        bytes += written;
+        count -= (size_t)written;
+    }
+    return true;
+}
+
+
+bool
+write_all_at(int fd, const BYTE *bytes, size_t count, off_t offset)
+{
+    while(count > 0) {
+        ssize_t written = pwrite(fd, bytes, count, offset);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            return false;
+        }
+        bytes += written;
+        count -= (size_t)written;
+        offset += written;
+    }
+    return true;
+}
+
+
 FileOp_Status
 move_temp_file_to_destination(char *tmp_filename, char *filename, struct stat *statinfo)
 {
@@ -133,3 +193,194 @@ make_filename_in_same_location(char *reference_name_and_path, char *wanted_name,
     return CAN_CONTINUE;
 }
 
+
+bool
+map_to_read(int in, Input_mapping *mapping)
+{
+    mapping->contents = NULL;
+    mapping->size = 0;
+    struct stat statinfo;
+    if(fstat(in, &statinfo)) {
+        return false;
+    }
+    if(!S_ISREG(statinfo.st_mode) || statinfo.st_size < MIN_MAPPED_FILE_SIZE) {
+        return false;
+    }
+    if((unsigned long long)statinfo.st_size > (unsigned long long)((size_t)-1)) {
+        return false;
+    }
+    size_t size = (size_t)statinfo.st_size;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if(size <= MAX_POPULATED_MAPPING_SIZE) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *contents = mmap(NULL, size, PROT_READ, flags, in, 0);
+    if(contents == MAP_FAILED) {
+        return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(contents, size, MADV_SEQUENTIAL);
+#endif
+    mapping->contents = contents;
+    mapping->size = size;
+    return true;
+}
+
+
+void
+unmap_input(Input_mapping *mapping)
+{
+    if(mapping->contents == NULL) {
+        return;
+    }
+    munmap(mapping->contents, mapping->size);
+    mapping->contents = NULL;
+    mapping->size = 0;
+}
+
+
+// Lets the kernel copy the first length bytes of in into out, without them going through
+// user space, and sharing the file system extents where it can (reflinks on btrfs or XFS).
+// Returns how many bytes got copied : possibly fewer than length, or none at all, e.g. when
+// the file systems don't support it. Then the rest has to be copied by hand.
+
+static off_t
+copy_prefix_in_kernel(int in, off_t length, int out)
+{
+    off_t in_offset = 0;
+#ifdef HAS_COPY_FILE_RANGE
+    while(in_offset < length) {
+        ssize_t copied = copy_file_range(in, &in_offset, out, NULL, (size_t)(length - in_offset), 0);
+        if(copied <= 0) {
+            break;
+        }
+    }
+#endif
+    return in_offset;
+}
+
+
+FileOp_Status
+copy_input_prefix(int in, Input_mapping *mapping, off_t length, int out, char *filename)
+{
+    off_t copied = in == NO_FD ? 0 : copy_prefix_in_kernel(in, length, out);
+    length -= copied;
+
+    if(mapping->contents) {
+        if(!write_all(out, mapping->contents + copied, (size_t)length)) {
+            fprintf(stdout, "%s : file access error during conversion of %s\n", PROGRAM_NAME, filename);
+            return FILEOP_ERROR;
+        }
+        return CAN_CONTINUE;
+    }
+
+    BYTE buffer[BUFFERSIZE];
+    while(length > 0) {
+        size_t chunk = length < BUFFERSIZE ? (size_t)length : BUFFERSIZE;
+        ssize_t got = pread(in, buffer, chunk, copied);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0 || !write_all(out, buffer, (size_t)got)) {
+            fprintf(stdout, "%s : file access error during conversion of %s\n", PROGRAM_NAME, filename);
+            return FILEOP_ERROR;
+        }
+        copied += got;
+        length -= got;
+    }
+    if(lseek(in, copied, SEEK_SET) < 0) {
+        fprintf(stdout, "%s : file access error during conversion of %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    return CAN_CONTINUE;
+}
+
+
+size_t
+io_buffer_size(int fd, struct stat *statinfo, size_t requested_size)
+{
+    if(requested_size) {
+        return requested_size;
+    }
+#ifdef F_GETPIPE_SZ
+    if(S_ISFIFO(statinfo->st_mode)) {
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if(pipe_size > BUFFERSIZE) {
+            return pipe_size < MAX_DEFAULT_BUFFER_SIZE ? (size_t)pipe_size : MAX_DEFAULT_BUFFER_SIZE;
+        }
+        return BUFFERSIZE;
+    }
+#endif
+    // Small files are read in one go, larger ones MAX_DEFAULT_BUFFER_SIZE at a time.
+    size_t block_size = statinfo->st_blksize > 0 ? (size_t)statinfo->st_blksize : BUFFERSIZE;
+    size_t size = BUFFERSIZE;
+    if(statinfo->st_size > MAX_DEFAULT_BUFFER_SIZE) {
+        size = MAX_DEFAULT_BUFFER_SIZE;
+    } else if(statinfo->st_size > BUFFERSIZE) {
+        size = (size_t)statinfo->st_size;
+    }
+    size = (size + block_size - 1) / block_size * block_size;
+    return size < MAX_BUFFER_SIZE ? size : MAX_BUFFER_SIZE;
+}
+
+
+FileOp_Status
+append_to_file(char *filename, const BYTE *bytes, size_t count)
+{
+    int fd = open(filename, O_WRONLY | O_APPEND);
+    if(fd < 0) {
+        fprintf(stdout, "%s : can not write over %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    bool err = !write_all(fd, bytes, count);
+    err = close(fd) || err;
+    if(err) {
+        fprintf(stdout, "%s : file access error while appending to %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    return CAN_CONTINUE;
+}
+
+
+FileOp_Status
+seek_input(int in, Input_mapping *mapping, off_t offset, char *filename)
+{
+    if(mapping->contents == NULL && lseek(in, offset, SEEK_SET) < 0) {
+        fprintf(stdout, "%s : can not read %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    return CAN_CONTINUE;
+}
+
+
+FileOp_Status
+open_to_overwrite(int *out, char *filename, off_t offset)
+{
+    *out = open(filename, O_WRONLY);
+    if(*out < 0) {
+        fprintf(stdout, "%s : can not write over %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    if(lseek(*out, offset, SEEK_SET) < 0) {
+        fprintf(stdout, "%s : can not write over %s\n", PROGRAM_NAME, filename);
+        close(*out);
+        return FILEOP_ERROR;
+    }
+    return CAN_CONTINUE;
+}
+
+
+FileOp_Status
+close_overwritten_file(int out, char *filename)
+{
+    off_t end = lseek(out, 0, SEEK_CUR);
+    int err = end < 0 || ftruncate(out, end);
+    err = close(out) || err;
+    if(err) {
+        fprintf(stdout, "%s : can not write over %s\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    return CAN_CONTINUE;
+}
@@ -0,0 +1,391 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for st_mtim
+#define _POSIX_C_SOURCE 200809L
+
+#include "git_index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+// SEE git_index.h FOR INTERFACE DOCUMENTATION
+
+
+// The layout of the index file is described in git's documentation,
+// under gitformat-index (formerly Documentation/technical/index-format.txt).
+//
+// header  : "DIRC", version, number of entries      (32 bit, big endian each)
+// entries : ctime, mtime (seconds, nanoseconds), dev, ino, mode, uid, gid, size
+//           (32 bit, big endian each), object name, 16 bit flags,
+//           16 more bit of flags if the extended flag is set (version 3 and up), path.
+//           Up to version 3, the path is 0 terminated, and followed by 1 to 8 zeros so
+//           that the entry's size is a multiple of 8. In version 4, the path is written
+//           as the number of bytes to strip from the end of the previous path, and what
+//           to append then, 0 terminated : no padding.
+// extensions, then a checksum of the whole, as long as an object name.
+
+#define INDEX_SIGNATURE "DIRC"
+#define INDEX_HEADER_SIZE 12
+#define ENTRY_STAT_SIZE 40
+
+#define SHA1_SIZE 20
+#define SHA256_SIZE 32
+
+#define FLAG_EXTENDED            0x4000
+#define FLAG_STAGE_SHIFT         12
+#define FLAG_STAGE_MASK          0x3
+#define FLAG_NAME_LENGTH_MASK    0x0FFF
+#define EXTENDED_FLAG_SKIP_WORKTREE 0x4000
+
+#define MAX_DOT_GIT_FILE_SIZE 4096
+
+struct Git_index {
+    const unsigned char *contents;     // the mapped index file
+    size_t size;
+    uint32_t version;
+    uint32_t entries_count;
+    size_t object_name_size;
+    uint32_t mtime_seconds;            // of the index file itself
+    uint32_t mtime_nanoseconds;
+
+    // where reading is at
+    size_t offset;
+    uint32_t read_count;
+    char *path;                        // version 4 : paths are rebuilt from the previous one
+    size_t path_length;
+    size_t path_capacity;
+};
+
+
+static uint32_t
+big_endian_32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint16_t
+big_endian_16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t
+modification_nanoseconds(struct stat *statinfo)
+{
+#if defined(__APPLE__)
+    return (uint32_t)statinfo->st_mtimespec.tv_nsec;
+#else
+    return (uint32_t)statinfo->st_mtim.tv_nsec;
+#endif
+}
+
+
+// git's variable length integers : 7 bits per byte, most significant first,
+// the high bit telling whether another byte follows, and 1 added at each step.
+// Returns false if they don't fit in what's left, or in a size_t.
+static bool
+read_varint(const unsigned char *p, size_t room, size_t *value, size_t *used)
+{
+    size_t i = 0;
+    if(room == 0) {
+        return false;
+    }
+    unsigned char c = p[i++];
+    size_t v = c & 127;
+    while(c & 128) {
+        if(i >= room || v > (((size_t)-1) >> 8)) {
+            return false;
+        }
+        c = p[i++];
+        v = ((v + 1) << 7) | (c & 127);
+    }
+    *value = v;
+    *used = i;
+    return true;
+}
+
+static bool
+has_consistent_name_length(uint16_t flags, size_t length)
+{
+    size_t recorded = flags & FLAG_NAME_LENGTH_MASK;
+    return length > 0 && (recorded == length || (recorded == FLAG_NAME_LENGTH_MASK && length >= recorded));
+}
+
+static bool
+reserve_path(Git_index *index, size_t length)
+{
+    if(length < index->path_capacity) {
+        return true;
+    }
+    size_t capacity = index->path_capacity ? index->path_capacity : 256;
+    while(capacity <= length) {
+        capacity *= 2;
+    }
+    char *path = realloc(index->path, capacity);
+    if(path == NULL) {
+        return false;
+    }
+    index->path = path;
+    index->path_capacity = capacity;
+    return true;
+}
+
+
+// Reads the entry at index->offset, and moves past it.
+// Returns false if it doesn't fit in the file, or doesn't look right.
+static bool
+read_entry(Git_index *index, Git_index_entry *entry)
+{
+    // The checksum follows the last entry.
+    if(index->offset + index->object_name_size > index->size) {
+        return false;
+    }
+    const unsigned char *start = index->contents + index->offset;
+    size_t available = index->size - index->object_name_size - index->offset;
+    size_t name_offset = ENTRY_STAT_SIZE + index->object_name_size + 2;
+    if(available < name_offset) {
+        return false;
+    }
+    entry->mtime_seconds = big_endian_32(start + 8);
+    entry->mtime_nanoseconds = big_endian_32(start + 12);
+    entry->mode = big_endian_32(start + 24);
+    entry->size = big_endian_32(start + 36);
+    uint16_t flags = big_endian_16(start + ENTRY_STAT_SIZE + index->object_name_size);
+    entry->stage = (flags >> FLAG_STAGE_SHIFT) & FLAG_STAGE_MASK;
+    entry->skip_worktree = false;
+    if(flags & FLAG_EXTENDED) {
+        if(index->version < 3 || available < name_offset + 2) {
+            return false;
+        }
+        entry->skip_worktree = big_endian_16(start + name_offset) & EXTENDED_FLAG_SKIP_WORKTREE;
+        name_offset += 2;
+    }
+    const unsigned char *name = start + name_offset;
+    size_t name_room = available - name_offset;
+
+    if(index->version < 4) {
+        const unsigned char *end = memchr(name, 0, name_room);
+        if(end == NULL) {
+            return false;
+        }
+        size_t length = (size_t)(end - name);
+        size_t entry_size = (name_offset + length + 8) & ~(size_t)7;
+        if(!has_consistent_name_length(flags, length) || entry_size > available) {
+            return false;
+        }
+        entry->path = (const char *)name;
+        entry->path_length = length;
+        index->offset += entry_size;
+        return true;
+    }
+
+    size_t stripped, used;
+    if(!read_varint(name, name_room, &stripped, &used) || stripped > index->path_length) {
+        return false;
+    }
+    const unsigned char *suffix = name + used;
+    const unsigned char *end = memchr(suffix, 0, name_room - used);
+    if(end == NULL) {
+        return false;
+    }
+    size_t suffix_length = (size_t)(end - suffix);
+    size_t length = index->path_length - stripped + suffix_length;
+    if(!has_consistent_name_length(flags, length) || !reserve_path(index, length)) {
+        return false;
+    }
+    memcpy(index->path + index->path_length - stripped, suffix, suffix_length);
+    index->path[length] = 0;
+    index->path_length = length;
+    entry->path = index->path;
+    entry->path_length = length;
+    index->offset += (size_t)(end + 1 - start);
+    return true;
+}
+
+static void
+rewind_index(Git_index *index)
+{
+    index->offset = INDEX_HEADER_SIZE;
+    index->read_count = 0;
+    index->path_length = 0;
+}
+
+// The index doesn't say how long object names are : they're taken to be
+// as long as those with which all the entries read right.
+static bool
+all_entries_read_right(Git_index *index, size_t object_name_size)
+{
+    Git_index_entry entry;
+    index->object_name_size = object_name_size;
+    rewind_index(index);
+    for(uint32_t i=0; i<index->entries_count; ++i) {
+        if(!read_entry(index, &entry)) {
+            return false;
+        }
+    }
+    rewind_index(index);
+    return true;
+}
+
+
+// Returns the name of the index file for the working tree in directory, to be freed,
+// or NULL. When .git is a file (worktrees, submodules), it reads "gitdir: <path>".
+static char *
+index_filename_for(const char *directory)
+{
+    size_t directory_length = strlen(directory);
+    char *dot_git = malloc(directory_length + sizeof("/.git"));
+    if(dot_git == NULL) {
+        return NULL;
+    }
+    sprintf(dot_git, "%s/.git", directory);
+    struct stat statinfo;
+    char *git_directory = NULL;
+    if(!stat(dot_git, &statinfo) && S_ISDIR(statinfo.st_mode)) {
+        git_directory = dot_git;
+        dot_git = NULL;
+    } else if(!stat(dot_git, &statinfo) && S_ISREG(statinfo.st_mode)) {
+        char contents[MAX_DOT_GIT_FILE_SIZE];
+        FILE *f = fopen(dot_git, "r");
+        size_t got = f ? fread(contents, 1, sizeof(contents) - 1, f) : 0;
+        if(f) {
+            fclose(f);
+        }
+        contents[got] = 0;
+        contents[strcspn(contents, "\r\n")] = 0;
+        const char *prefix = "gitdir: ";
+        if(!strncmp(contents, prefix, strlen(prefix)) && contents[strlen(prefix)]) {
+            char *target = contents + strlen(prefix);
+            git_directory = malloc(directory_length + strlen(target) + 2);
+            if(git_directory != NULL && target[0] == '/') {
+                strcpy(git_directory, target);
+            } else if(git_directory != NULL) {
+                sprintf(git_directory, "%s/%s", directory, target);
+            }
+        }
+    }
+    free(dot_git);
+    if(git_directory == NULL) {
+        return NULL;
+    }
+    char *filename = malloc(strlen(git_directory) + sizeof("/index"));
+    if(filename != NULL) {
+        sprintf(filename, "%s/index", git_directory);
+    }
+    free(git_directory);
+    return filename;
+}
+
+
+Git_index *
+open_git_index(const char *directory)
+{
+    char *filename = index_filename_for(directory);
+    if(filename == NULL) {
+        return NULL;
+    }
+    int fd = open(filename, O_RDONLY);
+    free(filename);
+    struct stat statinfo;
+    if(fd < 0 || fstat(fd, &statinfo) || statinfo.st_size < INDEX_HEADER_SIZE ||
+       (uintmax_t)statinfo.st_size > (size_t)-1) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    size_t size = (size_t)statinfo.st_size;
+    void *contents = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(contents == MAP_FAILED) {
+        return NULL;
+    }
+    Git_index *index = calloc(1, sizeof(Git_index));
+    if(index == NULL) {
+        munmap(contents, size);
+        return NULL;
+    }
+    index->contents = contents;
+    index->size = size;
+    index->version = big_endian_32(index->contents + 4);
+    index->entries_count = big_endian_32(index->contents + 8);
+    index->mtime_seconds = (uint32_t)statinfo.st_mtime;
+    index->mtime_nanoseconds = modification_nanoseconds(&statinfo);
+
+    bool usable = !memcmp(index->contents, INDEX_SIGNATURE, 4) &&
+                  index->version >= 2 && index->version <= 4 &&
+                  (all_entries_read_right(index, SHA1_SIZE) ||
+                   all_entries_read_right(index, SHA256_SIZE));
+    if(!usable) {
+        close_git_index(index);
+        return NULL;
+    }
+    return index;
+}
+
+
+void
+close_git_index(Git_index *index)
+{
+    if(index == NULL) {
+        return;
+    }
+    munmap((void *)index->contents, index->size);
+    free(index->path);
+    free(index);
+}
+
+
+bool
+next_git_index_entry(Git_index *index, Git_index_entry *entry)
+{
+    // All entries were read once when opening : they can't fail now.
+    if(index->read_count >= index->entries_count || !read_entry(index, entry)) {
+        return false;
+    }
+    ++ index->read_count;
+    return true;
+}
+
+
+// An entry whose modification time isn't older than the index itself could have been
+// modified again, after git stat'ed it, within the same timestamp : it's "racily clean".
+static bool
+is_racily_clean(Git_index *index, Git_index_entry *entry)
+{
+    return index->mtime_seconds < entry->mtime_seconds ||
+           (index->mtime_seconds == entry->mtime_seconds &&
+            index->mtime_nanoseconds <= entry->mtime_nanoseconds);
+}
+
+bool
+git_index_entry_is_unchanged(Git_index *index, Git_index_entry *entry, struct stat *statinfo)
+{
+    // git builds that don't record nanoseconds leave them to 0
+    return entry->size == (uint32_t)statinfo->st_size &&
+           entry->mtime_seconds == (uint32_t)statinfo->st_mtime &&
+           (entry->mtime_nanoseconds == 0 ||
+            entry->mtime_nanoseconds == modification_nanoseconds(statinfo)) &&
+           !is_racily_clean(index, entry);
+}
@@ -0,0 +1,74 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _GIT_INDEX_H_
+#define _GIT_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+//
+// A reader for git's index file (.git/index), that needs no git binary.
+//
+// The index lists the files git tracks, along with the stat info they had when git last
+// looked at them : files whose size and modification time still match haven't changed
+// since (see git_index_entry_is_unchanged).
+//
+// Versions 2, 3 and 4 of the format are read, with SHA-1 or SHA-256 object names.
+// Extensions (cached trees, untracked cache...) are ignored. The index file is checked
+// for consistency when opened, but its checksum isn't verified.
+//
+
+
+typedef struct Git_index Git_index;
+
+typedef struct {
+    const char *path;            // relative to the working tree, 0 terminated
+    size_t path_length;
+    uint32_t mode;               // git's mode : 0100644 or 0100755 for regular files
+    int stage;                   // 0, or 1 to 3 for the sides of an unresolved merge
+    bool skip_worktree;          // not checked out (sparse checkouts)
+    uint32_t mtime_seconds;
+    uint32_t mtime_nanoseconds;
+    uint32_t size;               // lower 32 bits of the size
+} Git_index_entry;
+
+#define GIT_MODE_TYPE_MASK    0170000
+#define GIT_MODE_REGULAR_FILE 0100000
+
+
+// Opens the index of the working tree found in directory : directory/.git/index, or
+// the index of the repository that directory/.git points to, when .git is a file.
+// Returns NULL if there's none, or if it can't be read or doesn't look right.
+Git_index *open_git_index(const char *directory);
+
+void close_git_index(Git_index *index);
+
+// Reads the entries one after the other, in the index's order (sorted by path, then stage).
+// Returns false once they've all been read. The entry's path is valid until the next call.
+bool next_git_index_entry(Git_index *index, Git_index_entry *entry);
+
+// Returns true if the file, as statinfo describes it, still has the size and modification
+// time the index recorded. Like git, entries that may have been modified within the same
+// timestamp the index was written at are taken as changed.
+bool git_index_entry_is_unchanged(Git_index *index, Git_index_entry *entry, struct stat *statinfo);
+
+
+#endif
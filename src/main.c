@@ -16,10 +16,13 @@
    limitations under the License.
 */
 
-
 #include "command_line_parser.h"
 #include "endlines.h"
+#include "scan_cache.h"
+#include "uring_reader.h"
 #include "walkers.h"
+#include "watcher.h"
+#include "worker_pool.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +55,16 @@ typedef struct {
     bool recurse;
     bool process_hidden;
     bool final_char_has_to_be_eol;
+    bool in_place;
+    size_t buffer_size;    // 0 to pick one per file
+    int jobs;              // number of files processed at a time
+    char *scan_cache_filename;   // NULL when not using a scan cache
+    bool git;                    // filenames are git working trees, whose tracked files are processed
+    bool git_changed_only;       // ... only those that changed since git last looked at them
+    FILE *file_list;             // --files-from, read after filenames ; NULL otherwise
+    bool watch;                  // once done, keep processing files as they change
+    Watcher *watcher;            // with watch, for the time files are processed
+    Scan_cache *scan_cache;      // opened from scan_cache_filename, for the time files are processed
     char **filenames;
     int file_count;
 } Invocation;
@@ -63,11 +76,31 @@ typedef struct {
 // Its main use is to keep track of what has been done
 // It is complemented by the walkers' tracker object, defined in walkers.h,
 // that'll hold results that are specific to the walker (e.g. skipped directories and hidden files)
+//
+// Small files are not processed right away : they are queued, to be read a whole batch
+// at a time by the uring reader (see uring_reader.h), when it's available.
+//
+// With --jobs, each worker thread has its own accumulator (and its own tmp file name),
+// and their totals are summed up once all files are done.
+
+typedef struct {
+    char filename[WALKERS_MAX_PATH_LENGTH];
+    struct stat statinfo;
+} Queued_file;
 
 typedef struct {
     int outcome_totals[FILEOP_STATUSES_COUNT];
     int convention_totals[CONVENTIONS_COUNT];
     Invocation *invocation;
+
+    bool tried_uring_reader;
+    Uring_reader *uring_reader;   // NULL until tried, or if io_uring is unavailable
+    Queued_file *queue;           // URING_BATCH_SIZE entries, allocated along with the reader
+    int queued_count;
+
+    int processed_since_catching_up;   // with watch, see catch_up_with_changes
+
+    char session_tmp_filename[48];
 } Batch_outcome_accumulator;
 
 
@@ -170,6 +203,98 @@ got_final_char_has_to_be_eol_flag(const char *arg, void *context)
     ((Invocation *)context)->final_char_has_to_be_eol = true;
 }
 
+void
+got_in_place_flag(const char *arg, void *context)
+{
+    ((Invocation *)context)->in_place = true;
+}
+
+void
+got_git_flag(const char *arg, void *context)
+{
+    ((Invocation *)context)->git = true;
+}
+
+void
+got_git_changed_flag(const char *arg, void *context)
+{
+    ((Invocation *)context)->git = true;
+    ((Invocation *)context)->git_changed_only = true;
+}
+
+// --buffer-size=N, where N is a number of bytes, possibly followed by K or M
+void
+got_buffer_size_flag(const char *value, void *context)
+{
+    char *suffix = NULL;
+    unsigned long long size = strtoull(value, &suffix, 10);
+    if(suffix != NULL && (*suffix == 'K' || *suffix == 'k')) {
+        size *= 1024;
+        ++ suffix;
+    } else if(suffix != NULL && (*suffix == 'M' || *suffix == 'm')) {
+        size *= 1024*1024;
+        ++ suffix;
+    }
+    if(suffix == value || *suffix != 0 ||
+       size < BUFFERSIZE || size > MAX_BUFFER_SIZE) {
+        fprintf(stderr, "%s : --buffer-size expects a size between %dK and %dM, such as --buffer-size=1M\n",
+                PROGRAM_NAME, BUFFERSIZE/1024, MAX_BUFFER_SIZE/(1024*1024));
+        exit(EXIT_FAILURE);
+    }
+    ((Invocation *)context)->buffer_size = (size_t)size;
+}
+
+// --binary-extensions=FILE
+void
+got_binary_extensions_flag(const char *value, void *context)
+{
+    if(!load_known_binary_file_extensions(value)) {
+        fprintf(stderr, "%s : can not read binary extensions from %s (one per line, up to %d characters each)\n",
+                PROGRAM_NAME, value, MAX_BINARY_EXTENSION_LENGTH);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// --cache=FILE
+void
+got_scan_cache_flag(const char *value, void *context)
+{
+    ((Invocation *)context)->scan_cache_filename = (char *)value;
+}
+
+void
+got_watch_flag(const char *arg, void *context)
+{
+    ((Invocation *)context)->watch = true;
+    ((Invocation *)context)->recurse = true;
+}
+
+// --files-from=FILE, - for stdin
+void
+got_files_from_flag(const char *value, void *context)
+{
+    FILE *list = strcmp(value, "-") ? fopen(value, "r") : stdin;
+    if(list == NULL) {
+        fprintf(stderr, "%s : can not read a list of files from %s\n", PROGRAM_NAME, value);
+        exit(EXIT_FAILURE);
+    }
+    ((Invocation *)context)->file_list = list;
+}
+
+// --jobs=N, -j N
+void
+got_jobs_flag(const char *value, void *context)
+{
+    char *end = NULL;
+    long jobs = strtol(value, &end, 10);
+    if(end == value || *end != 0 || jobs < 1 || jobs > MAX_WORKER_THREADS) {
+        fprintf(stderr, "%s : --jobs expects a number between 1 and %d, such as --jobs=4\n",
+                PROGRAM_NAME, MAX_WORKER_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    ((Invocation *)context)->jobs = (int)jobs;
+}
+
 void
 got_non_flag_arg(char *argument, int arg_index, void *context)
 {
@@ -196,7 +321,16 @@ parse_endlines_command_line(int argc, char **argv)
       {.short_flag='k', .long_flag="keepdate", .callback=got_keepdate_flag},
       {.short_flag='b', .long_flag="binaries", .callback=got_process_binaries_flag},
       {.short_flag='r', .long_flag="recurse",  .callback=got_recurse_flag},
-      {.short_flag='h', .long_flag="hidden",   .callback=got_process_hidden_flag}
+      {.short_flag='h', .long_flag="hidden",   .callback=got_process_hidden_flag},
+      {.short_flag='i', .long_flag="inplace",  .callback=got_in_place_flag},
+      {.short_flag='j', .long_flag="jobs",     .callback=got_jobs_flag, .takes_value=true},
+      {.short_flag=0,   .long_flag="buffer-size", .callback=got_buffer_size_flag, .takes_value=true},
+      {.short_flag=0,   .long_flag="binary-extensions", .callback=got_binary_extensions_flag, .takes_value=true},
+      {.short_flag=0,   .long_flag="cache",    .callback=got_scan_cache_flag, .takes_value=true},
+      {.short_flag=0,   .long_flag="git",      .callback=got_git_flag},
+      {.short_flag=0,   .long_flag="git-changed", .callback=got_git_changed_flag},
+      {.short_flag=0,   .long_flag="files-from", .callback=got_files_from_flag, .takes_value=true},
+      {.short_flag=0,   .long_flag="watch",    .callback=got_watch_flag}
     };
     const int flags_count = (int)(sizeof(flags)/sizeof(flags[0]));
     set_flag_descriptions(command_line_schema, flags, flags_count);
@@ -209,6 +343,12 @@ parse_endlines_command_line(int argc, char **argv)
         .keepdate=false, .verbose=false,
         .recurse=false, .process_hidden=false,
         .final_char_has_to_be_eol=false,
+        .in_place=false,
+        .buffer_size=0,
+        .jobs=1,
+        .scan_cache_filename=NULL, .scan_cache=NULL,
+        .git=false, .git_changed_only=false, .file_list=NULL,
+        .watch=false, .watcher=NULL,
         .filenames=NULL, .file_count=0
     };
 
@@ -224,12 +364,25 @@ parse_endlines_command_line(int argc, char **argv)
         fprintf(stderr, "%s : you need to specify an action. See %s --help\n", PROGRAM_NAME, PROGRAM_NAME);
         exit(EXIT_FAILURE);
     }
+    if(cmd_line_invocation.git && cmd_line_invocation.file_list != NULL) {
+        fprintf(stderr, "%s : --files-from can't be used along with --git\n", PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+    }
+    if(cmd_line_invocation.watch && (cmd_line_invocation.file_count == 0 ||
+                                     cmd_line_invocation.git || cmd_line_invocation.file_list != NULL)) {
+        fprintf(stderr, "%s : --watch needs directories to watch, and can't be used along with --git or --files-from\n",
+                PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+    }
     return cmd_line_invocation;
 }
 
 void destroy_invocation_on_stack(Invocation *i)
 {
     free(i->filenames);
+    if(i->file_list != NULL && i->file_list != stdin) {
+        fclose(i->file_list);
+    }
 }
 
 
@@ -242,12 +395,22 @@ void destroy_invocation_on_stack(Invocation *i)
 
 #define TRY partial_status =
 #define CATCH if(partial_status != CAN_CONTINUE) { return partial_status; }
-#define CATCH_CLOSE_IN if(partial_status != CAN_CONTINUE) { fclose(in); return partial_status; }
 
 
-// Make up once a file name for all tmp file creations from this process.
+// Inputs are read through their mapping if map_to_read could make one,
+// through their file descriptor otherwise.
+static void
+close_input(int in, Input_mapping *mapping)
+{
+    unmap_input(mapping);
+    close_dropping_cache(in);
+}
+
+
+// Make up once a file name for all tmp file creations from this process,
+// or from one of its worker threads : worker_index is then that thread's number.
 void
-initialize_session_tmp_filename(char *session_tmp_filename)
+initialize_session_tmp_filename(char *session_tmp_filename, int worker_index)
 {
     struct {
         long safety_padding_a;
@@ -258,7 +421,23 @@ initialize_session_tmp_filename(char *session_tmp_filename)
     pid_holder.pid = getpid();
 
     int suffix = (int)(((long)pid_holder.pid) % 9999999);
-    sprintf(session_tmp_filename, "%s%d", TMP_FILENAME_BASE, suffix);
+    if(worker_index < 0) {
+        sprintf(session_tmp_filename, "%s%d", TMP_FILENAME_BASE, suffix);
+    } else {
+        sprintf(session_tmp_filename, "%s%d_%d", TMP_FILENAME_BASE, suffix, worker_index);
+    }
+}
+
+
+// Binary files are skipped, unless -b is set, as soon as their first block gives them away
+// (see looks_like_binary_head) : they're not read any further.
+static FileOp_Status
+sniff_input(int in, Input_mapping *mapping, Invocation *invocation)
+{
+    if(!invocation->binaries && sniffs_as_binary(in, mapping)) {
+        return SKIPPED_BINARY;
+    }
+    return CAN_CONTINUE;
 }
 
 
@@ -267,18 +446,27 @@ initialize_session_tmp_filename(char *session_tmp_filename)
 // (binaries, or already in the wanted convention).
 // Running the pre_conversion_check can speed-up endlines by a large factor.
 // pre_conversion_check is normally called by the convert_one_file function.
+//
+// The scan stops at the first line ending that is not in the destination convention.
+// Whatever the outcome, file_report is filled with the scan's findings : when the file
+// does need converting, they tell how much of it can be kept as is, and the conversion
+// carries on from there.
 FileOp_Status
-pre_conversion_check(FILE *in, char *filename,
+pre_conversion_check(int in, Input_mapping *mapping, char *filename,
+                     size_t buffer_size,
                      Conversion_Report *file_report,
                      Invocation *invocation)
 {
     Conversion_Parameters p = {
-        .instream=in,
-        .outstream=NULL,
+        .in_fd=in,
+        .in_memory=mapping->contents,
+        .in_memory_size=mapping->size,
+        .out_fd=NO_FD,
         .dst_convention=invocation->dst_convention,
         .interrupt_if_not_like_dst_convention=true,
         .interrupt_if_non_text=!invocation->binaries,
-        .final_char_has_to_be_eol=false
+        .final_char_has_to_be_eol=false,
+        .buffer_size=buffer_size
     };
     Conversion_Report preliminary_report = convert_stream(p);
 
@@ -290,6 +478,10 @@ pre_conversion_check(FILE *in, char *filename,
     if(preliminary_report.contains_non_text_chars && !invocation->binaries) {
         return SKIPPED_BINARY;
     }
+    memcpy(file_report, &preliminary_report, sizeof(Conversion_Report));
+    if(preliminary_report.stopped_at_nonconforming_eol) {
+        return CAN_CONTINUE;
+    }
     Convention src_convention = get_source_convention(&preliminary_report);
     if(
         (src_convention == NO_CONVENTION && !invocation->final_char_has_to_be_eol) ||
@@ -297,7 +489,6 @@ pre_conversion_check(FILE *in, char *filename,
         (src_convention == invocation->dst_convention && 
 	   (!invocation->final_char_has_to_be_eol || preliminary_report.has_final_eol) )) {
 
-        memcpy(file_report, &preliminary_report, sizeof(Conversion_Report));
         return DONE;
     }
     return CAN_CONTINUE;
@@ -305,49 +496,193 @@ pre_conversion_check(FILE *in, char *filename,
 
 
 
-// convert_one_file : drives the whole conversion sequence for one file,
-//                    and fills in the file_report according to the findings.
+// Conversion parameters for an input that is read from offset on.
+// Its file descriptor, if it's not read through its mapping, must have been positioned there.
+// Nothing gets written unless out_fd is set.
+static Conversion_Parameters
+input_parameters_from(int in, Input_mapping *mapping, off_t offset, Encoding_layout layout,
+                      size_t buffer_size)
+{
+    Conversion_Parameters p = {
+        .in_fd=in,
+        .out_fd=NO_FD,
+        .in_memory=mapping->contents ? mapping->contents + offset : NULL,
+        .in_memory_size=mapping->contents ? mapping->size - (size_t)offset : 0,
+        .encoding_layout=layout,
+        .buffer_size=buffer_size
+    };
+    return p;
+}
+
+
+// In-place conversion, for the -i option.
+// Only for destination conventions that never make a file grow (but for an added final
+// EOL, at the very end) : LF and CR. The file gets overwritten from its first non conforming
+// line ending on, through a second descriptor that always lags behind the reading one, and is
+// truncated at the end. The inode, and with it hard links, ownership, permissions and
+// extended attributes, is kept, and no temporary copy is made. But unlike the temporary
+// file route, an interruption halfway would leave the file partly converted.
+// Expects the findings of pre_conversion_check in file_report, and updates them.
+
+static bool
+can_convert_in_place(Convention dst_convention)
+{
+    return dst_convention == LF || dst_convention == CR;
+}
+
+FileOp_Status
+convert_in_place(int in, Input_mapping *mapping, char *filename, size_t buffer_size,
+                 Invocation *invocation, Conversion_Report *file_report)
+{
+    FileOp_Status partial_status;
+    int out = NO_FD;
+    Conversion_Report prefix_report = *file_report;
+    off_t prefix_length = prefix_report.conforming_prefix_length;
+
+    // The pre-conversion check has stopped early : before anything gets overwritten,
+    // make sure that the rest of the file holds no binary data.
+    if(!invocation->binaries) {
+        TRY seek_input(in, mapping, prefix_length, filename); CATCH
+        Conversion_Parameters tail_check = input_parameters_from(in, mapping, prefix_length,
+                                                                 prefix_report.encoding_layout,
+                                                                 buffer_size);
+        tail_check.dst_convention = NO_CONVENTION;
+        tail_check.interrupt_if_non_text = true;
+        Conversion_Report tail_report = convert_stream(tail_check);
+        if(tail_report.error_during_conversion) {
+            fprintf(stdout, "%s : file access error during preliminary check of %s\n",
+                    PROGRAM_NAME, filename);
+            return FILEOP_ERROR;
+        }
+        if(tail_report.contains_non_text_chars) {
+            return SKIPPED_BINARY;
+        }
+    }
+
+    TRY seek_input(in, mapping, prefix_length, filename); CATCH
+    TRY open_to_overwrite(&out, filename, prefix_length); CATCH
+
+    Conversion_Parameters p = input_parameters_from(in, mapping, prefix_length,
+                                                    prefix_report.encoding_layout, buffer_size);
+    p.out_fd = out;
+    p.dst_convention = invocation->dst_convention;
+    p.final_char_has_to_be_eol = invocation->final_char_has_to_be_eol;
+    Conversion_Report report = convert_stream(p);
+
+    partial_status = close_overwritten_file(out, filename);
+    if(report.error_during_conversion || partial_status != CAN_CONTINUE) {
+        fprintf(stdout, "%s : file access error during in-place conversion of %s\n"
+                        "  -- it may have been left partly converted\n", PROGRAM_NAME, filename);
+        return FILEOP_ERROR;
+    }
+    append_report(&prefix_report, &report);
+    memcpy(file_report, &prefix_report, sizeof(Conversion_Report));
+    return DONE;
+}
+
+
+
+// A file that the pre-conversion check went through whole, already in the destination
+// convention but for a missing final EOL that -f asks for, only needs that EOL appended :
+// there's no need for a temporary copy, and the inode is kept.
+// Stray bytes at the end of a UTF-16 file are left to the general route.
+
+static bool
+only_lacks_final_eol(Conversion_Report *report, struct stat *statinfo, Invocation *invocation)
+{
+    return invocation->final_char_has_to_be_eol &&
+           !report->stopped_at_nonconforming_eol &&
+           !report->has_final_eol &&
+           report->conforming_prefix_length == statinfo->st_size;
+}
+
+FileOp_Status
+append_final_eol(char *filename, Invocation *invocation, Conversion_Report *file_report)
+{
+    FileOp_Status partial_status;
+    BYTE newline[MAX_NEWLINE_SIZE];
+    size_t newline_size = encode_newline(invocation->dst_convention,
+                                         file_report->encoding_layout, newline);
+    TRY append_to_file(filename, newline, newline_size); CATCH
+    file_report->has_final_eol = true;
+    return DONE;
+}
+
+
+
+// convert_input : drives the whole conversion sequence for one file, once opened,
+//                 and fills in the file_report according to the findings.
+//                 The file is read only once : the part that the pre-conversion check
+//                 has found to be already conforming is copied verbatim,
+//                 and the conversion proper resumes right after it.
+//                 The input is left open : it is up to the caller to close it.
 // Parameters :
+//    - in, mapping : the opened file, read through its mapping if it has one (see close_input) ;
+//                    in may be NO_FD if the mapping holds the file's whole contents
 //    - filename
 //    - statinfo : the file's original stat info, that will be reused when writing the
 //                 resulting file. Passing it as a parameter allows us to avoid multiple
 //                 calls to stat.
 //    - invocation
+//    - session_tmp_filename : see initialize_session_tmp_filename ; the converted file
+//                             is written under that name, before it replaces the original.
 //    - file_report : this is an out-parameter ; it is up to the caller to allocate it.
-FileOp_Status
-convert_one_file(char *filename, struct stat *statinfo,
-        Invocation *invocation,
-        Conversion_Report *file_report)
+static FileOp_Status
+convert_input(int in, Input_mapping *mapping, char *filename, struct stat *statinfo,
+              Invocation *invocation, char *session_tmp_filename,
+              Conversion_Report *file_report)
 {
     FileOp_Status partial_status;
-    FILE *in  = NULL;
-    FILE *out = NULL;
-    static char session_tmp_filename[40] = "";
-    if(session_tmp_filename[0]==0) {
-        initialize_session_tmp_filename(session_tmp_filename);
-    }
+    int out = NO_FD;
     char local_tmp_file_name[WALKERS_MAX_PATH_LENGTH];
     struct utimbuf original_file_times = get_file_times(statinfo);
 
     TRY check_write_access(filename); CATCH
-    TRY open_to_read(&in, filename); CATCH
-    TRY pre_conversion_check(in, filename, file_report, invocation); CATCH_CLOSE_IN
-    rewind(in);
-    TRY make_filename_in_same_location(filename, session_tmp_filename, local_tmp_file_name); CATCH_CLOSE_IN
-    TRY open_to_write(&out, local_tmp_file_name); CATCH_CLOSE_IN
+    TRY sniff_input(in, mapping, invocation); CATCH
+    size_t buffer_size = io_buffer_size(in, statinfo, invocation->buffer_size);
+    TRY pre_conversion_check(in, mapping, filename, buffer_size, file_report, invocation); CATCH
+
+    if(only_lacks_final_eol(file_report, statinfo, invocation)) {
+        partial_status = append_final_eol(filename, invocation, file_report);
+        if(partial_status == DONE && invocation->keepdate) {
+            utime(filename, &original_file_times);
+        }
+        return partial_status;
+    }
 
-    Conversion_Parameters p = {
-        .instream=in,
-        .outstream=out,
-        .dst_convention=invocation->dst_convention,
-        .interrupt_if_not_like_dst_convention=false,
-        .interrupt_if_non_text=!invocation->binaries,
-        .final_char_has_to_be_eol=invocation->final_char_has_to_be_eol
-    };
-    Conversion_Report report = convert_stream(p);
+    if(invocation->in_place && can_convert_in_place(invocation->dst_convention)) {
+        partial_status = convert_in_place(in, mapping, filename, buffer_size,
+                                          invocation, file_report);
+        if(partial_status == DONE && invocation->keepdate) {
+            utime(filename, &original_file_times);
+        }
+        return partial_status;
+    }
+
+    TRY make_filename_in_same_location(filename, session_tmp_filename, local_tmp_file_name); CATCH
+    TRY open_to_write(&out, local_tmp_file_name); CATCH
+
+    Conversion_Report prefix_report = *file_report;
+    off_t prefix_length = prefix_report.conforming_prefix_length;
+    partial_status = copy_input_prefix(in, mapping, prefix_length, out, filename);
+    if(partial_status != CAN_CONTINUE) {
+        close(out);
+        remove(local_tmp_file_name);
+        return partial_status;
+    }
 
-    fclose(in);
-    fclose(out);
+    Conversion_Parameters p = input_parameters_from(in, mapping, prefix_length,
+                                                    prefix_report.encoding_layout, buffer_size);
+    p.out_fd = out;
+    p.dst_convention = invocation->dst_convention;
+    p.interrupt_if_non_text = !invocation->binaries;
+    p.final_char_has_to_be_eol = invocation->final_char_has_to_be_eol;
+    Conversion_Report report = invocation->jobs > 1 ? convert_stream_in_parallel(p, invocation->jobs)
+                                                    : convert_stream(p);
+
+    if(close(out)) {
+        report.error_during_conversion = true;
+    }
 
     if(report.error_during_conversion) {
         remove(local_tmp_file_name);
@@ -364,37 +699,56 @@ convert_one_file(char *filename, struct stat *statinfo,
     if(invocation->keepdate) {
         utime(filename, &original_file_times);
     }
-    memcpy(file_report, &report, sizeof(Conversion_Report));
+    append_report(&prefix_report, &report);
+    memcpy(file_report, &prefix_report, sizeof(Conversion_Report));
     return DONE;
 }
 
+// convert_one_file : opens one file, and converts it through convert_input (see above).
+FileOp_Status
+convert_one_file(char *filename, struct stat *statinfo,
+        Invocation *invocation, char *session_tmp_filename,
+        Conversion_Report *file_report)
+{
+    FileOp_Status partial_status;
+    int in = NO_FD;
+    Input_mapping mapping;
+    TRY open_to_read(&in, filename); CATCH
+    map_to_read(in, &mapping);
+    partial_status = convert_input(in, &mapping, filename, statinfo, invocation,
+                                   session_tmp_filename, file_report);
+    close_input(in, &mapping);
+    return partial_status;
+}
+
 
 
 // check_one_file : reads one file, and fills in the file_report according to the findings.
 // Parameters :
 //    - filename
+//    - statinfo : the file's stat info, as already known to the caller
 //    - invocation
 //    - file_report : this is an out-parameter ; it is up to the caller to allocate it.
 
-FileOp_Status
-check_one_file(char *filename, Invocation *invocation, Conversion_Report *file_report)
+static FileOp_Status
+check_input(int in, Input_mapping *mapping, char *filename, struct stat *statinfo,
+            Invocation *invocation, Conversion_Report *file_report)
 {
     FileOp_Status partial_status;
-    FILE *in  = NULL;
-    TRY open_to_read(&in, filename); CATCH
-
+    TRY sniff_input(in, mapping, invocation); CATCH
     Conversion_Parameters p = {
-        .instream=in,
-        .outstream=NULL,
+        .in_fd=in,
+        .in_memory=mapping->contents,
+        .in_memory_size=mapping->size,
+        .out_fd=NO_FD,
         .dst_convention=NO_CONVENTION,
         .interrupt_if_not_like_dst_convention=false,
         .interrupt_if_non_text=!invocation->binaries,
-        .final_char_has_to_be_eol=false
+        .final_char_has_to_be_eol=false,
+        .buffer_size=io_buffer_size(in, statinfo, invocation->buffer_size)
     };
     Conversion_Report report = convert_stream(p);
 
-    fclose(in);
-
     if(report.error_during_conversion) {
         fprintf(stdout, "%s : file access error during check of %s\n", PROGRAM_NAME, filename);
         return FILEOP_ERROR;
@@ -406,6 +760,42 @@ check_one_file(char *filename, Invocation *invocation, Conversion_Report *file_r
     return DONE;
 }
 
+FileOp_Status
+check_one_file(char *filename, struct stat *statinfo, Invocation *invocation,
+               Conversion_Report *file_report)
+{
+    FileOp_Status partial_status;
+    int in = NO_FD;
+    Input_mapping mapping;
+    TRY open_to_read(&in, filename); CATCH
+    map_to_read(in, &mapping);
+    partial_status = check_input(in, &mapping, filename, statinfo, invocation, file_report);
+    close_input(in, &mapping);
+    return partial_status;
+}
+
+
+
+// check_read_file and convert_read_file : the same as check_one_file and convert_one_file,
+// for a file whose whole contents have already been read in memory, by the uring reader.
+// They work from those contents as from a mapping : the file isn't read again.
+
+FileOp_Status
+check_read_file(char *filename, struct stat *statinfo, Input_mapping *contents,
+                Invocation *invocation, Conversion_Report *file_report)
+{
+    return check_input(NO_FD, contents, filename, statinfo, invocation, file_report);
+}
+
+FileOp_Status
+convert_read_file(char *filename, struct stat *statinfo, Input_mapping *contents,
+                  Invocation *invocation, char *session_tmp_filename,
+                  Conversion_Report *file_report)
+{
+    return convert_input(NO_FD, contents, filename, statinfo, invocation,
+                         session_tmp_filename, file_report);
+}
+
 #undef TRY
 #undef CATCH
 
@@ -478,39 +868,227 @@ print_outcome_totals(Outcome_totals_for_display t)
 }
 
 
-// This function is called for each file seen by the directory walker. See walkers.h
-// Noticeably, p_accumulator is the context object that is passed across calls.
-void
-walkers_callback(char *filename, struct stat *statinfo, void *p_accumulator)
+static void
+account_for_outcome(char *filename, FileOp_Status outcome, Conversion_Report *file_report,
+                    Batch_outcome_accumulator *accumulator)
 {
-    FileOp_Status outcome;
-    Conversion_Report file_report;
     Convention source_convention = NO_CONVENTION;
-    Batch_outcome_accumulator *accumulator = (Batch_outcome_accumulator*) p_accumulator;
-
-    if(!accumulator->invocation->binaries &&
-            has_known_binary_file_extension(filename)) {
-        outcome = SKIPPED_BINARY;
-    } else if(accumulator->invocation->dst_convention == NO_CONVENTION) {
-        outcome = check_one_file(filename, accumulator->invocation, &file_report);
-    } else {
-        outcome = convert_one_file(filename, statinfo, accumulator->invocation, &file_report);
-    }
     if(outcome == DONE) {
-        source_convention = get_source_convention(&file_report);
+        source_convention = get_source_convention(file_report);
         ++ accumulator->convention_totals[source_convention];
     }
     ++ accumulator->outcome_totals[outcome];
     if(accumulator->invocation->verbose) {
         print_verbose_file_outcome(filename, outcome, source_convention);
     }
+    Watcher *watcher = accumulator->invocation->watcher;
+    if(watcher == NULL) {
+        return;
+    }
+    if(outcome == DONE && accumulator->invocation->dst_convention != NO_CONVENTION) {
+        note_processed_file(watcher, filename);
+    }
+    // The directories are watched while they're walked : what processing them raises is taken
+    // in as it goes, rather than left to overflow the kernel's queue of events.
+    if(++ accumulator->processed_since_catching_up >= WATCH_CATCH_UP_INTERVAL) {
+        catch_up_with_changes(watcher);
+        accumulator->processed_since_catching_up = 0;
+    }
+}
+
+
+// =============== THE SCAN CACHE ===============
+//
+// With --cache, what's found out about each file is remembered (see scan_cache.h) :
+// a file that hasn't changed since is answered from that on the next runs, as long as it
+// tells enough. It does for binaries, and for files that have been scanned whole ;
+// when converting, unless they do need converting.
+
+// Returns CAN_CONTINUE if the file needs processing all the same.
+static FileOp_Status
+outcome_from_cached_scan(Cached_scan *scan, Invocation *invocation)
+{
+    if(scan->binary && !invocation->binaries) {
+        return SKIPPED_BINARY;
+    }
+    if(!scan->complete) {
+        return CAN_CONTINUE;
+    }
+    if(invocation->dst_convention == NO_CONVENTION) {
+        return DONE;
+    }
+    Convention src_convention = get_source_convention(&(scan->report));
+    if((src_convention == NO_CONVENTION && !invocation->final_char_has_to_be_eol) ||
+       (src_convention == invocation->dst_convention &&
+          (!invocation->final_char_has_to_be_eol || scan->report.has_final_eol))) {
+        return DONE;
+    }
+    return CAN_CONTINUE;
+}
+
+// Returns CAN_CONTINUE if the file can't be answered from the cache.
+static FileOp_Status
+find_cached_outcome(struct stat *statinfo, Invocation *invocation, Cached_scan *scan)
+{
+    if(invocation->scan_cache == NULL || !find_cached_scan(invocation->scan_cache, statinfo, scan)) {
+        return CAN_CONTINUE;
+    }
+    return outcome_from_cached_scan(scan, invocation);
+}
+
+// As when processing the file, converting needs write access all the same.
+static void
+answer_from_scan_cache(char *filename, FileOp_Status outcome, Cached_scan *scan,
+                       Batch_outcome_accumulator *accumulator)
+{
+    Invocation *invocation = accumulator->invocation;
+    if(invocation->dst_convention != NO_CONVENTION && check_write_access(filename) != CAN_CONTINUE) {
+        outcome = FILEOP_ERROR;
+    }
+    account_for_outcome(filename, outcome, &(scan->report), accumulator);
+}
+
+// A converted file is remembered as it now is : all its line endings in the destination convention.
+static void
+remember_outcome(char *filename, struct stat *statinfo, FileOp_Status outcome,
+                 Conversion_Report *file_report, Invocation *invocation)
+{
+    Cached_scan scan;
+    memset(&scan, 0, sizeof(scan));
+    if(outcome == SKIPPED_BINARY) {
+        scan.binary = true;
+        store_cached_scan(invocation->scan_cache, statinfo, &scan);
+        return;
+    }
+    if(outcome != DONE) {
+        return;
+    }
+    scan.binary = file_report->contains_non_text_chars;
+    scan.complete = true;
+    scan.report = *file_report;
+    if(invocation->dst_convention == NO_CONVENTION) {
+        store_cached_scan(invocation->scan_cache, statinfo, &scan);
+        return;
+    }
+    struct stat converted_statinfo;
+    if(stat(filename, &converted_statinfo)) {
+        return;
+    }
+    unsigned int line_endings_count = 0;
+    for(int i=0; i<CONVENTIONS_COUNT; ++i) {
+        line_endings_count += scan.report.count_by_convention[i];
+        scan.report.count_by_convention[i] = 0;
+    }
+    scan.report.count_by_convention[invocation->dst_convention] = line_endings_count;
+    store_cached_scan(invocation->scan_cache, &converted_statinfo, &scan);
+}
+
+
+// Processes one file, and accounts for the outcome.
+// contents, if not NULL, holds the file's contents as read by the uring reader.
+static void
+process_file(char *filename, struct stat *statinfo, Input_mapping *contents,
+             Batch_outcome_accumulator *accumulator)
+{
+    FileOp_Status outcome;
+    Conversion_Report file_report;
+    Invocation *invocation = accumulator->invocation;
+
+    if(!invocation->binaries && has_known_binary_file_extension(filename)) {
+        account_for_outcome(filename, SKIPPED_BINARY, NULL, accumulator);
+        return;
+    }
+    if(invocation->dst_convention == NO_CONVENTION) {
+        outcome = contents ? check_read_file(filename, statinfo, contents, invocation, &file_report)
+                           : check_one_file(filename, statinfo, invocation, &file_report);
+    } else {
+        outcome = contents ? convert_read_file(filename, statinfo, contents, invocation,
+                                               accumulator->session_tmp_filename, &file_report)
+                           : convert_one_file(filename, statinfo, invocation,
+                                              accumulator->session_tmp_filename, &file_report);
+    }
+    if(invocation->scan_cache != NULL) {
+        remember_outcome(filename, statinfo, outcome, &file_report, invocation);
+    }
+    account_for_outcome(filename, outcome, &file_report, accumulator);
+}
+
+
+// Reads all queued files as one batch, and processes them in order.
+// Those that the uring reader couldn't read whole are processed the usual way.
+static void
+process_queued_files(Batch_outcome_accumulator *accumulator)
+{
+    Uring_read_item items[URING_BATCH_SIZE];
+    int count = accumulator->queued_count;
+    if(count == 0) {
+        return;
+    }
+    for(int i=0; i<count; ++i) {
+        items[i].filename = accumulator->queue[i].filename;
+        items[i].expected_size = accumulator->queue[i].statinfo.st_size;
+    }
+    read_batch(accumulator->uring_reader, items, count);
+    for(int i=0; i<count; ++i) {
+        Input_mapping contents = {.contents=items[i].contents, .size=items[i].size};
+        process_file(accumulator->queue[i].filename, &(accumulator->queue[i].statinfo),
+                     items[i].ok ? &contents : NULL, accumulator);
+    }
+    accumulator->queued_count = 0;
+}
+
+
+// Small files are worth queuing for the uring reader, unless they'd be skipped anyway.
+static bool
+is_worth_queuing(char *filename, struct stat *statinfo, Batch_outcome_accumulator *accumulator)
+{
+    if(statinfo->st_size > URING_MAX_FILE_SIZE ||
+       strlen(filename) >= WALKERS_MAX_PATH_LENGTH ||
+       (!accumulator->invocation->binaries && has_known_binary_file_extension(filename))) {
+        return false;
+    }
+    if(!accumulator->tried_uring_reader) {
+        accumulator->tried_uring_reader = true;
+        accumulator->queue = malloc(URING_BATCH_SIZE * sizeof(Queued_file));
+        accumulator->uring_reader = accumulator->queue ? new_uring_reader() : NULL;
+    }
+    return accumulator->uring_reader != NULL;
+}
+
+
+// This function is called for each file seen by the directory walker. See walkers.h
+// Noticeably, p_accumulator is the context object that is passed across calls.
+// Files are processed in the order they're seen : queued files go first.
+void
+walkers_callback(char *filename, struct stat *statinfo, void *p_accumulator)
+{
+    Batch_outcome_accumulator *accumulator = (Batch_outcome_accumulator*) p_accumulator;
+
+    Cached_scan scan;
+    FileOp_Status cached_outcome = find_cached_outcome(statinfo, accumulator->invocation, &scan);
+    if(cached_outcome != CAN_CONTINUE) {
+        process_queued_files(accumulator);
+        answer_from_scan_cache(filename, cached_outcome, &scan, accumulator);
+        return;
+    }
+    if(is_worth_queuing(filename, statinfo, accumulator)) {
+        Queued_file *queued = &(accumulator->queue[accumulator->queued_count ++]);
+        strcpy(queued->filename, filename);
+        queued->statinfo = *statinfo;
+        if(accumulator->queued_count == URING_BATCH_SIZE) {
+            process_queued_files(accumulator);
+        }
+        return;
+    }
+    process_queued_files(accumulator);
+    process_file(filename, statinfo, NULL, accumulator);
 }
 
 
 // Initializes the context object that will be kept over the whole
-// directory walking process.
+// directory walking process. worker_index is -1, except for worker threads' accumulators.
 Batch_outcome_accumulator
-make_accumulator(Invocation *invocation)
+make_accumulator(Invocation *invocation, int worker_index)
 {
     Batch_outcome_accumulator a;
     for(int i=0; i<FILEOP_STATUSES_COUNT; ++i) {
@@ -520,9 +1098,43 @@ make_accumulator(Invocation *invocation)
         a.convention_totals[i] = 0;
     }
     a.invocation = invocation;
+    a.tried_uring_reader = false;
+    a.uring_reader = NULL;
+    a.queue = NULL;
+    a.queued_count = 0;
+    a.processed_since_catching_up = 0;
+    initialize_session_tmp_filename(a.session_tmp_filename, worker_index);
     return a;
 }
 
+// Processes the files that are still queued, and releases the uring reader.
+void
+finish_accumulator(Batch_outcome_accumulator *accumulator)
+{
+    process_queued_files(accumulator);
+    destroy_uring_reader(accumulator->uring_reader);
+    free(accumulator->queue);
+    accumulator->uring_reader = NULL;
+    accumulator->queue = NULL;
+}
+
+static void
+finish_accumulator_callback(void *p_accumulator)
+{
+    finish_accumulator((Batch_outcome_accumulator*) p_accumulator);
+}
+
+static void
+add_accumulator_totals(Batch_outcome_accumulator *sum, Batch_outcome_accumulator *a)
+{
+    for(int i=0; i<FILEOP_STATUSES_COUNT; ++i) {
+        sum->outcome_totals[i] += a->outcome_totals[i];
+    }
+    for(int i=0; i<CONVENTIONS_COUNT; ++i) {
+        sum->convention_totals[i] += a->convention_totals[i];
+    }
+}
+
 
 Walk_tracker
 make_tracker(Invocation *invocation, Batch_outcome_accumulator *accumulator)
@@ -539,12 +1151,110 @@ make_tracker(Invocation *invocation, Batch_outcome_accumulator *accumulator)
 }
 
 
+// Walks the files named on the command line, then those listed by --files-from.
+// With --git, walks the files tracked in the working trees named on the command line
+// (the current directory by default).
+static void
+walk_invocation_files(Invocation *invocation, Walk_tracker *tracker)
+{
+    if(!invocation->git) {
+        walk_filenames(invocation->filenames, invocation->file_count, tracker);
+        if(invocation->file_list != NULL) {
+            walk_filename_list(invocation->file_list, tracker);
+        }
+    } else if(invocation->file_count == 0) {
+        walk_git_index(".", invocation->git_changed_only, tracker);
+    } else {
+        for(int i=0; i<invocation->file_count; ++i) {
+            walk_git_index(invocation->filenames[i], invocation->git_changed_only, tracker);
+        }
+    }
+}
+
+
+// Walks the files with invocation->jobs threads, and hands them over to a pool of as many
+// worker threads, each with its own accumulator. Their totals are then added to main_accumulator.
+// Returns false if no thread could be started : nothing has been walked then.
+//
+// Workers print their messages to stdout concurrently. Each message is written with
+// one single call to fprintf, and stdio locks the stream during each call :
+// messages may come in any order, but never mixed up together.
+static bool
+walk_with_worker_pool(Walk_tracker *tracker, Batch_outcome_accumulator *main_accumulator)
+{
+    Invocation *invocation = main_accumulator->invocation;
+    int jobs = invocation->jobs;
+    Batch_outcome_accumulator *accumulators = malloc(jobs * sizeof(Batch_outcome_accumulator));
+    void **contexts = malloc(jobs * sizeof(void*));
+    Worker_pool *pool = NULL;
+    if(accumulators != NULL && contexts != NULL) {
+        for(int i=0; i<jobs; ++i) {
+            accumulators[i] = make_accumulator(invocation, i);
+            contexts[i] = &(accumulators[i]);
+        }
+        pool = new_worker_pool(jobs, walkers_callback, finish_accumulator_callback, contexts);
+    }
+    if(pool != NULL) {
+        tracker->process_file = &submit_to_worker_pool;
+        tracker->accumulator = pool;
+        tracker->threads = jobs;      // submit_to_worker_pool is thread safe
+        walk_invocation_files(invocation, tracker);
+        finish_worker_pool(pool);
+        for(int i=0; i<jobs; ++i) {
+            add_accumulator_totals(main_accumulator, &(accumulators[i]));
+        }
+    }
+    free(accumulators);
+    free(contexts);
+    return pool != NULL;
+}
+
+
+// With --watch, once the files have been walked, those that change are processed as they do :
+// only them. That goes on until endlines is interrupted. New directories get watched as
+// they're walked. Files are processed one at a time then, whatever jobs is.
+static void
+keep_watching(Invocation *invocation)
+{
+    Watcher *watcher = invocation->watcher;
+    Batch_outcome_accumulator accumulator = make_accumulator(invocation, -1);
+    Walk_tracker tracker = make_tracker(invocation, &accumulator);
+    tracker.enter_directory = &watch_directory;
+    tracker.enter_directory_context = watcher;
+
+    if(!invocation->quiet) {
+        fprintf(stdout, "%s : watching %d directories for changes\n",
+                PROGRAM_NAME, watched_directories_count(watcher));
+    }
+    char **filenames;
+    int count;
+    while((count = wait_for_changed_files(watcher, &filenames)) >= 0) {
+        walk_filenames(filenames, count, &tracker);
+        process_queued_files(&accumulator);
+        fflush(stdout);
+        done_with_changed_files(watcher);
+    }
+    fprintf(stdout, "%s : can not watch for changes any more\n", PROGRAM_NAME);
+    finish_accumulator(&accumulator);
+}
+
+
 void
 convert_files(Invocation *invocation)
 {
-    Batch_outcome_accumulator accumulator = make_accumulator(invocation);
+    Batch_outcome_accumulator accumulator = make_accumulator(invocation, -1);
     Walk_tracker tracker = make_tracker(invocation, &accumulator);
 
+    if(invocation->watch) {
+        invocation->watcher = new_watcher(invocation->filenames, invocation->file_count);
+        if(invocation->watcher == NULL) {
+            fprintf(stderr, "%s : can not watch for changes on this system\n", PROGRAM_NAME);
+            exit(EXIT_FAILURE);
+        }
+        tracker.enter_directory = &watch_directory;
+        tracker.enter_directory_context = invocation->watcher;
+    }
+
     if(!invocation->quiet) {
         if(invocation->dst_convention == NO_CONVENTION) {
             fprintf(stdout, "%s : dry run, scanning files\n", PROGRAM_NAME);
@@ -555,7 +1265,20 @@ convert_files(Invocation *invocation)
         }
     }
 
-    walk_filenames(invocation->filenames, invocation->file_count, &tracker);
+    if(invocation->scan_cache_filename != NULL) {
+        invocation->scan_cache = open_scan_cache(invocation->scan_cache_filename);
+        if(invocation->scan_cache == NULL) {
+            fprintf(stdout, "%s : can not use %s as a cache -- going on without it\n",
+                    PROGRAM_NAME, invocation->scan_cache_filename);
+        }
+    }
+
+    if(invocation->jobs <= 1 || !walk_with_worker_pool(&tracker, &accumulator)) {
+        walk_invocation_files(invocation, &tracker);
+        finish_accumulator(&accumulator);
+    }
+    close_scan_cache(invocation->scan_cache);
+    invocation->scan_cache = NULL;
 
     if(!invocation->quiet) {
         Outcome_totals_for_display totals = {
@@ -569,6 +1292,13 @@ convert_files(Invocation *invocation)
         };
         print_outcome_totals(totals);
     }
+
+    if(invocation->watcher != NULL) {
+        done_with_changed_files(invocation->watcher);
+        keep_watching(invocation);
+        destroy_watcher(invocation->watcher);
+        invocation->watcher = NULL;
+    }
 }
 
 // ============== HANDLING THE CONVERSION OF STANDARD STREAMS ===============
@@ -592,6 +1322,18 @@ void print_stream_conversion_outcome(Conversion_Parameters *parameters, Conversi
     }
 }
 
+// Reading, converting and writing on threads of their own only pays off
+// if these threads can run at the same time. --jobs asks for threads anyway.
+static bool
+has_several_processors()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1;
+#else
+    return true;
+#endif
+}
+
 void convert_stdin_to_stdout(Invocation *invocation)
 {
     if(!invocation->quiet) {
@@ -603,13 +1345,23 @@ void convert_stdin_to_stdout(Invocation *invocation)
                     convention_display_names[invocation->dst_convention]);
         }
     }
+    struct stat statinfo;
+    if(fstat(STDIN_FILENO, &statinfo)) {
+        memset(&statinfo, 0, sizeof(statinfo));
+    }
     Conversion_Parameters p = {
-        .instream=stdin,
-        .outstream= invocation->dst_convention==NO_CONVENTION ? NULL : stdout,
+        .in_fd=STDIN_FILENO,
+        .out_fd= invocation->dst_convention==NO_CONVENTION ? NO_FD : STDOUT_FILENO,
         .dst_convention=invocation->dst_convention,
-        .interrupt_if_non_text=false
+        .interrupt_if_non_text=false,
+        .buffer_size=io_buffer_size(STDIN_FILENO, &statinfo, invocation->buffer_size),
+        .pipelined=(invocation->jobs > 1 || has_several_processors())
     };
-    Conversion_Report report = convert_stream(p);
+    Conversion_Report report = convert_stream_spliced(p);
+    if(report.error_during_conversion) {
+        fprintf(stderr, "%s : stream access error during conversion of standard input\n", PROGRAM_NAME);
+        exit(EXIT_FAILURE);
+    }
     if(!invocation->quiet) {
         print_stream_conversion_outcome(&p, &report);
     }
@@ -625,7 +1377,8 @@ main(int argc, char**argv)
         display_help_and_quit();
     }
     Invocation cmd_line_invocation = parse_endlines_command_line(argc, argv);
-    if(cmd_line_invocation.file_count > 0) {
+    if(cmd_line_invocation.file_count > 0 || cmd_line_invocation.git ||
+       cmd_line_invocation.file_list != NULL) {
         convert_files(&cmd_line_invocation);
     } else {
         convert_stdin_to_stdout(&cmd_line_invocation);
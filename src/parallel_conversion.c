@@ -0,0 +1,161 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pthreads, and ftruncate
+#define _POSIX_C_SOURCE 200809L
+
+#include "endlines.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// SEE endlines.h FOR INTERFACE DOCUMENTATION
+
+
+// Each chunk is run through convert_stream twice, on its own thread :
+//    - first to count its line endings, and find out about non text characters,
+//    - then to convert it, writing at the offset that the counts of the chunks before it add up to.
+//
+// As no chunk starts between the CR and the LF of a CR-LF, each chunk can be converted
+// without knowing about the others : a 13 at the end of a chunk is a lone CR.
+
+typedef struct {
+    Conversion_Parameters p;
+    Conversion_Report report;
+    pthread_t thread;
+    bool started;
+} Chunk;
+
+
+static void *
+run_chunk(void *p_chunk)
+{
+    Chunk *chunk = (Chunk *)p_chunk;
+    chunk->report = convert_stream(chunk->p);
+    return NULL;
+}
+
+// Chunks whose thread can't be started are run by the calling thread, as is the first one.
+static void
+run_chunks(Chunk *chunks, int count)
+{
+    for(int i=1; i<count; ++i) {
+        chunks[i].started = !pthread_create(&(chunks[i].thread), NULL, run_chunk, &(chunks[i]));
+    }
+    run_chunk(&(chunks[0]));
+    for(int i=1; i<count; ++i) {
+        if(chunks[i].started) {
+            pthread_join(chunks[i].thread, NULL);
+        } else {
+            run_chunk(&(chunks[i]));
+        }
+    }
+}
+
+
+// Size in bytes of a converted chunk, as told by its counting report.
+static off_t
+converted_size(Chunk *chunk, Conversion_Report *counts, off_t newline_size)
+{
+    unsigned int *count = counts->count_by_convention;
+    off_t size = (off_t)chunk->p.in_memory_size - count[CR] - count[LF] - 2*(off_t)count[CRLF];
+    size += (count[CR] + count[LF] + (off_t)count[CRLF]) * newline_size;
+    if(chunk->p.final_char_has_to_be_eol && !counts->has_final_eol) {
+        size += newline_size;
+    }
+    return size;
+}
+
+
+Conversion_Report
+convert_stream_in_parallel(Conversion_Parameters p, int thread_count)
+{
+    int chunks_count = (int)(p.in_memory_size / MIN_PARALLEL_CHUNK_SIZE);
+    if(chunks_count > thread_count) {
+        chunks_count = thread_count;
+    }
+    off_t start_offset = p.write_at_offset ? p.out_offset : lseek(p.out_fd, 0, SEEK_CUR);
+    if(chunks_count < 2 || p.in_memory == NULL || p.encoding_layout != WT_1BYTE ||
+       p.out_fd == NO_FD || p.interrupt_if_not_like_dst_convention || start_offset < 0) {
+        return convert_stream(p);
+    }
+    Chunk *chunks = calloc(chunks_count, sizeof(Chunk));
+    if(chunks == NULL) {
+        return convert_stream(p);
+    }
+
+    // Splitting, so that no chunk starts with the LF of a CR-LF
+    size_t chunk_start = 0;
+    for(int i=0; i<chunks_count; ++i) {
+        size_t chunk_end = p.in_memory_size;
+        if(i < chunks_count - 1) {
+            chunk_end = p.in_memory_size / chunks_count * (i+1);
+            if(chunk_end < chunk_start) {
+                chunk_end = chunk_start;
+            }
+            if(chunk_end > 0 && p.in_memory[chunk_end-1] == 13 && p.in_memory[chunk_end] == 10) {
+                ++ chunk_end;
+            }
+        }
+        chunks[i].p = p;
+        chunks[i].p.in_memory = p.in_memory + chunk_start;
+        chunks[i].p.in_memory_size = chunk_end - chunk_start;
+        chunk_start = chunk_end;
+    }
+
+    // Counting
+    for(int i=0; i<chunks_count; ++i) {
+        chunks[i].p.out_fd = NO_FD;
+        chunks[i].p.dst_convention = NO_CONVENTION;
+        chunks[i].p.final_char_has_to_be_eol = false;
+    }
+    run_chunks(chunks, chunks_count);
+
+    BYTE newline[MAX_NEWLINE_SIZE];
+    off_t newline_size = (off_t)encode_newline(p.dst_convention, WT_1BYTE, newline);
+    off_t offset = start_offset;
+    bool skip_binary = false;
+    for(int i=0; i<chunks_count; ++i) {
+        skip_binary = skip_binary || (p.interrupt_if_non_text && chunks[i].report.contains_non_text_chars);
+        chunks[i].p.out_fd = p.out_fd;
+        chunks[i].p.dst_convention = p.dst_convention;
+        chunks[i].p.final_char_has_to_be_eol = p.final_char_has_to_be_eol && i == chunks_count - 1;
+        chunks[i].p.write_at_offset = true;
+        chunks[i].p.out_offset = offset;
+        offset += converted_size(&(chunks[i]), &(chunks[i].report), newline_size);
+    }
+
+    // Converting, unless there's no need to : then the counting reports tell why
+    if(!skip_binary) {
+        if(ftruncate(p.out_fd, offset)) {
+            chunks[0].report.error_during_conversion = true;
+        } else {
+            run_chunks(chunks, chunks_count);
+            lseek(p.out_fd, offset, SEEK_SET);
+        }
+    }
+
+    Conversion_Report report = chunks[0].report;
+    for(int i=1; i<chunks_count; ++i) {
+        append_report(&report, &(chunks[i].report));
+    }
+    free(chunks);
+    return report;
+}
@@ -0,0 +1,364 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pthreads, ftruncate and st_mtim
+#define _POSIX_C_SOURCE 200809L
+
+#include "scan_cache.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// SEE scan_cache.h FOR INTERFACE DOCUMENTATION
+
+
+// The cache file : a header, then capacity entries, an open addressing hash table
+// keyed by device and inode, with linear probing. Entries are never removed one by one :
+// those to drop are left out when the table gets rebuilt, as it grows.
+
+#define SCAN_CACHE_MAGIC "ENDLSCAN"
+#define SCAN_CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t capacity;        // a power of two
+    uint64_t count;
+    uint32_t run;             // incremented each time the cache is opened
+    uint32_t in_use;          // set while a process has it open
+    BYTE padding[24];
+} Cache_header;
+
+#define ENTRY_IN_USE         1
+#define ENTRY_BINARY         2
+#define ENTRY_COMPLETE       4
+#define ENTRY_HAS_FINAL_EOL  8
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_seconds;
+    uint32_t mtime_nanoseconds;
+    uint32_t count_by_convention[CONVENTIONS_COUNT];
+    uint32_t run;             // the last run that used the entry
+    uint8_t flags;
+    uint8_t encoding_layout;
+    uint8_t padding[2];
+} Cache_entry;
+
+struct Scan_cache {
+    int fd;
+    Cache_header *header;     // the mapped file
+    Cache_entry *entries;     // right after the header
+    size_t mapped_size;
+    time_t started;           // files modified since a second before that are not remembered
+    bool full;
+    pthread_mutex_t lock;
+};
+
+
+static uint64_t
+modification_nanoseconds(struct stat *statinfo)
+{
+#if defined(__APPLE__)
+    return (uint64_t)statinfo->st_mtimespec.tv_nsec;
+#else
+    return (uint64_t)statinfo->st_mtim.tv_nsec;
+#endif
+}
+
+static size_t
+file_size_for(uint64_t capacity)
+{
+    return sizeof(Cache_header) + capacity * sizeof(Cache_entry);
+}
+
+static uint64_t
+hash_file_id(uint64_t device, uint64_t inode)
+{
+    uint64_t h = inode ^ (device * 0x9E3779B97F4A7C15ULL);
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+// Returns the entry for the file, or the free entry where it would go.
+static Cache_entry *
+find_entry(Cache_entry *entries, uint64_t capacity, uint64_t device, uint64_t inode)
+{
+    uint64_t slot = hash_file_id(device, inode) & (capacity - 1);
+    while((entries[slot].flags & ENTRY_IN_USE) &&
+          (entries[slot].device != device || entries[slot].inode != inode)) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return &(entries[slot]);
+}
+
+
+// Maps the whole file, that must be file_size_for(capacity) long.
+static bool
+map_cache_file(Scan_cache *cache, uint64_t capacity)
+{
+    size_t size = file_size_for(capacity);
+    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if(mapped == MAP_FAILED) {
+        return false;
+    }
+    cache->header = (Cache_header *)mapped;
+    cache->entries = (Cache_entry *)((BYTE *)mapped + sizeof(Cache_header));
+    cache->mapped_size = size;
+    return true;
+}
+
+static void
+unmap_cache_file(Scan_cache *cache)
+{
+    if(cache->header != NULL) {
+        munmap(cache->header, cache->mapped_size);
+        cache->header = NULL;
+        cache->entries = NULL;
+    }
+}
+
+// Empties the file, and sets it up again with a table of capacity entries.
+static bool
+start_over(Scan_cache *cache, uint64_t capacity, uint32_t run)
+{
+    unmap_cache_file(cache);
+    if(ftruncate(cache->fd, 0) || ftruncate(cache->fd, (off_t)file_size_for(capacity)) ||
+       !map_cache_file(cache, capacity)) {
+        return false;
+    }
+    memcpy(cache->header->magic, SCAN_CACHE_MAGIC, sizeof(cache->header->magic));
+    cache->header->version = SCAN_CACHE_VERSION;
+    cache->header->entry_size = sizeof(Cache_entry);
+    cache->header->capacity = capacity;
+    cache->header->count = 0;
+    cache->header->run = run;
+    return true;
+}
+
+static bool
+is_usable_cache_file(Scan_cache *cache, off_t file_size)
+{
+    Cache_header *h = cache->header;
+    return h->version == SCAN_CACHE_VERSION &&
+           h->entry_size == sizeof(Cache_entry) &&
+           (h->capacity & (h->capacity - 1)) == 0 &&
+           file_size == (off_t)file_size_for(h->capacity) &&
+           !h->in_use;
+}
+
+static bool
+lock_cache_file(int fd)
+{
+    struct flock lock = {.l_type=F_WRLCK, .l_whence=SEEK_SET, .l_start=0, .l_len=0};
+    return fcntl(fd, F_SETLK, &lock) == 0;
+}
+
+
+Scan_cache *
+open_scan_cache(const char *filename)
+{
+    Scan_cache *cache = calloc(1, sizeof(Scan_cache));
+    if(cache == NULL) {
+        return NULL;
+    }
+    cache->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    struct stat statinfo;
+    if(cache->fd < 0 || !lock_cache_file(cache->fd) || fstat(cache->fd, &statinfo)) {
+        if(cache->fd >= 0) {
+            close(cache->fd);
+        }
+        free(cache);
+        return NULL;
+    }
+    // Whatever isn't empty, nor a cache file, is left alone.
+    // (A cache file whose rebuilding failed halfway is left without its magic number.)
+    static const char no_magic[sizeof(SCAN_CACHE_MAGIC)] = {0};
+    Cache_header header;
+    bool is_cache_file = statinfo.st_size >= (off_t)sizeof(Cache_header) &&
+                         pread(cache->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                         (!memcmp(header.magic, SCAN_CACHE_MAGIC, sizeof(header.magic)) ||
+                          !memcmp(header.magic, no_magic, sizeof(header.magic)));
+    if(statinfo.st_size > 0 && !is_cache_file) {
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    bool usable = false;
+    uint32_t run = 1;
+    if(is_cache_file && header.capacity >= SCAN_CACHE_INITIAL_CAPACITY &&
+       header.capacity <= SCAN_CACHE_MAX_CAPACITY &&
+       map_cache_file(cache, header.capacity)) {
+        usable = is_usable_cache_file(cache, statinfo.st_size);
+        run = header.run + 1;
+    }
+    if(!usable && !start_over(cache, SCAN_CACHE_INITIAL_CAPACITY, run)) {
+        unmap_cache_file(cache);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    cache->header->run = run;
+    cache->header->in_use = 1;
+    cache->started = time(NULL);
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+
+void
+close_scan_cache(Scan_cache *cache)
+{
+    if(cache == NULL) {
+        return;
+    }
+    if(cache->header != NULL) {
+        cache->header->in_use = 0;
+    }
+    unmap_cache_file(cache);
+    close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+
+// Rebuilds the table, leaving out entries that haven't been used in a while, and
+// doubling its capacity if it's still more than a quarter full after that.
+// Returns false if the table couldn't be rebuilt : it's left as it was then.
+static bool
+grow(Scan_cache *cache)
+{
+    uint64_t capacity = cache->header->capacity;
+    uint32_t run = cache->header->run;
+    uint64_t kept = 0;
+    Cache_entry *old_entries = malloc(capacity * sizeof(Cache_entry));
+    if(old_entries == NULL) {
+        return false;
+    }
+    for(uint64_t i=0; i<capacity; ++i) {
+        Cache_entry *e = &(cache->entries[i]);
+        if((e->flags & ENTRY_IN_USE) && run - e->run < SCAN_CACHE_KEPT_RUNS) {
+            old_entries[kept ++] = *e;
+        }
+    }
+    uint64_t new_capacity = capacity;
+    while(kept > new_capacity / 4 && new_capacity < SCAN_CACHE_MAX_CAPACITY) {
+        new_capacity *= 2;
+    }
+    if(kept > new_capacity / 4 && new_capacity == capacity) {
+        free(old_entries);
+        return false;
+    }
+    if(!start_over(cache, new_capacity, run)) {
+        // The file is then left without its magic number : it will start over next time
+        free(old_entries);
+        return false;
+    }
+    cache->header->in_use = 1;
+    for(uint64_t i=0; i<kept; ++i) {
+        *find_entry(cache->entries, new_capacity, old_entries[i].device, old_entries[i].inode) = old_entries[i];
+    }
+    cache->header->count = kept;
+    free(old_entries);
+    return true;
+}
+
+
+bool
+find_cached_scan(Scan_cache *cache, struct stat *statinfo, Cached_scan *scan)
+{
+    bool found = false;
+    pthread_mutex_lock(&cache->lock);
+    if(cache->header != NULL) {
+        Cache_entry *e = find_entry(cache->entries, cache->header->capacity,
+                                    (uint64_t)statinfo->st_dev, (uint64_t)statinfo->st_ino);
+        found = (e->flags & ENTRY_IN_USE) &&
+                e->size == (uint64_t)statinfo->st_size &&
+                e->mtime_seconds == (int64_t)statinfo->st_mtime &&
+                e->mtime_nanoseconds == modification_nanoseconds(statinfo);
+        if(found) {
+            e->run = cache->header->run;
+            memset(scan, 0, sizeof(Cached_scan));
+            scan->binary = (e->flags & ENTRY_BINARY) != 0;
+            scan->complete = (e->flags & ENTRY_COMPLETE) != 0;
+            for(int i=0; i<CONVENTIONS_COUNT; ++i) {
+                scan->report.count_by_convention[i] = e->count_by_convention[i];
+            }
+            scan->report.contains_non_text_chars = scan->binary;
+            scan->report.has_final_eol = (e->flags & ENTRY_HAS_FINAL_EOL) != 0;
+            scan->report.encoding_layout = (Encoding_layout)e->encoding_layout;
+            scan->report.conforming_prefix_length = statinfo->st_size;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+
+void
+store_cached_scan(Scan_cache *cache, struct stat *statinfo, Cached_scan *scan)
+{
+    if(statinfo->st_mtime >= cache->started - 1) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    if(cache->header != NULL && !cache->full) {
+        Cache_entry *e = find_entry(cache->entries, cache->header->capacity,
+                                    (uint64_t)statinfo->st_dev, (uint64_t)statinfo->st_ino);
+        if(!(e->flags & ENTRY_IN_USE) && 2 * (cache->header->count + 1) > cache->header->capacity) {
+            if(grow(cache)) {
+                e = find_entry(cache->entries, cache->header->capacity,
+                               (uint64_t)statinfo->st_dev, (uint64_t)statinfo->st_ino);
+            } else {
+                cache->full = true;
+                e = NULL;
+            }
+        }
+        if(e != NULL) {
+            if(!(e->flags & ENTRY_IN_USE)) {
+                ++ cache->header->count;
+            }
+            memset(e, 0, sizeof(Cache_entry));
+            e->device = (uint64_t)statinfo->st_dev;
+            e->inode = (uint64_t)statinfo->st_ino;
+            e->size = (uint64_t)statinfo->st_size;
+            e->mtime_seconds = (int64_t)statinfo->st_mtime;
+            e->mtime_nanoseconds = (uint32_t)modification_nanoseconds(statinfo);
+            for(int i=0; i<CONVENTIONS_COUNT; ++i) {
+                e->count_by_convention[i] = scan->report.count_by_convention[i];
+            }
+            e->run = cache->header->run;
+            e->encoding_layout = (uint8_t)scan->report.encoding_layout;
+            e->flags = ENTRY_IN_USE | (scan->binary ? ENTRY_BINARY : 0) |
+                       (scan->complete ? ENTRY_COMPLETE : 0) |
+                       (scan->report.has_final_eol ? ENTRY_HAS_FINAL_EOL : 0);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,76 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _SCAN_CACHE_H_
+#define _SCAN_CACHE_H_
+
+#include "endlines.h"
+
+//
+// The scan cache : remembers, from one run to the next, what scanning each file found out.
+//
+// Files are known by their device and inode, and a finding holds as long as the file's size
+// and modification time are the same : unchanged files are then answered from their stat
+// info alone, without being opened.
+//
+// The cache is a file, mapped in memory : a hash table of fixed size entries, that grows
+// as needed. Entries for files that haven't been seen for a while are dropped when it grows.
+// Files modified in the last couple of seconds are not remembered : they could still
+// change within the same modification time.
+//
+// One process at a time uses a given cache file ; within that process, any thread can.
+//
+
+// Capacity of a new cache, in entries.
+#define SCAN_CACHE_INITIAL_CAPACITY 4096
+
+// The cache doesn't grow past that many entries : it then stops taking new ones in.
+#define SCAN_CACHE_MAX_CAPACITY (16*1024*1024)
+
+// Entries not used in that many runs are dropped when the cache grows.
+#define SCAN_CACHE_KEPT_RUNS 16
+
+
+typedef struct Scan_cache Scan_cache;
+
+// What's known about a file
+typedef struct {
+    bool binary;                 // the file holds non text characters
+    bool complete;               // report is about the whole file ; otherwise only binary is known
+    Conversion_Report report;
+} Cached_scan;
+
+
+// Opens the cache file, creating it if needed. A cache file that's damaged, was left
+// open by a process that didn't finish, or was written by another version, starts over empty.
+// Returns NULL if the file can't be opened, is in use by another process, or isn't a cache
+// file (nor empty) : it's then left alone.
+Scan_cache *open_scan_cache(const char *filename);
+
+// Writes the cache back, and closes it.
+void close_scan_cache(Scan_cache *cache);
+
+
+// Returns true, and fills in scan, if the cache knows about the file as statinfo describes it.
+bool find_cached_scan(Scan_cache *cache, struct stat *statinfo, Cached_scan *scan);
+
+// Remembers scan for the file as statinfo describes it, in place of what was known about it.
+void store_cached_scan(Scan_cache *cache, struct stat *statinfo, Cached_scan *scan);
+
+
+#endif
@@ -0,0 +1,277 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _SCAN_KERNELS_H_
+#define _SCAN_KERNELS_H_
+
+
+// Low level scanning kernels, used by the conversion loop to jump over
+// plain text a whole vector at a time.
+//
+// A "special" code is one that the conversion loop has to look at individually :
+// CR (13), LF (10), or any code that is_non_text_code would flag,
+// that is everything below 32 except TAB (9), VT (11) and FF (12).
+// This holds for bytes as well as for 16 bit code units.
+//
+// The vectorized versions are picked at compile time : AVX2 if the compiler
+// targets it (e.g. -mavx2 or -march=native), SSE2 otherwise on x86, and a
+// plain C loop everywhere else.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef BYTE
+#define BYTE unsigned char
+#endif
+
+
+// Bit i is set if code i (i < 32) is special.
+// All of 0..31, but for 9, 11 and 12.
+#define SPECIAL_CONTROL_CODES_MASK 0xFFFFE5FFu
+
+static inline bool
+is_special_code(unsigned int w)
+{
+    return w < 32 && ((SPECIAL_CONTROL_CODES_MASK >> w) & 1);
+}
+
+static inline int
+count_set_bits_64(uint64_t mask)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(mask);
+#else
+    mask = mask - ((mask >> 1) & 0x5555555555555555ULL);
+    mask = (mask & 0x3333333333333333ULL) + ((mask >> 2) & 0x3333333333333333ULL);
+    mask = (mask + (mask >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((mask * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline int
+lowest_set_bit_index(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int index = 0;
+    while(!(mask & 1)) {
+        mask >>= 1;
+        ++ index;
+    }
+    return index;
+#endif
+}
+
+
+// Returns the offset of the first special byte among the length bytes starting at p,
+// or length if there is none.
+
+static inline size_t
+find_next_special_byte(const BYTE *p, size_t length)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i max_control = _mm256_set1_epi8(31);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i tab = _mm256_set1_epi8(9);
+    const __m256i vt  = _mm256_set1_epi8(11);
+    const __m256i ff  = _mm256_set1_epi8(12);
+    for(; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_subs_epu8(v, max_control), zero);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                          _mm256_or_si256(_mm256_cmpeq_epi8(v, vt), _mm256_cmpeq_epi8(v, ff)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_andnot_si256(allowed, control));
+        if(mask) {
+            return i + lowest_set_bit_index(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i max_control = _mm_set1_epi8(31);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tab = _mm_set1_epi8(9);
+    const __m128i vt  = _mm_set1_epi8(11);
+    const __m128i ff  = _mm_set1_epi8(12);
+    for(; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_subs_epu8(v, max_control), zero);
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+                          _mm_or_si128(_mm_cmpeq_epi8(v, vt), _mm_cmpeq_epi8(v, ff)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_andnot_si128(allowed, control));
+        if(mask) {
+            return i + lowest_set_bit_index(mask);
+        }
+    }
+#endif
+
+    for(; i < length; ++i) {
+        if(is_special_code(p[i])) {
+            return i;
+        }
+    }
+    return length;
+}
+
+
+// Returns the index of the first special code unit among the unit_count 16 bit
+// code units starting at p, or unit_count if there is none.
+// big_endian gives the byte order of the code units, as detected from the BOM.
+
+static inline unsigned int
+read_code_unit(const BYTE *p, bool big_endian)
+{
+    return big_endian ? ((unsigned int)p[0] << 8) | p[1]
+                      : ((unsigned int)p[1] << 8) | p[0];
+}
+
+static inline size_t
+find_next_special_unit(const BYTE *p, size_t unit_count, bool big_endian)
+{
+    size_t i = 0;
+
+    // x86 lanes are little-endian : big-endian units get their bytes swapped first.
+#if defined(__AVX2__)
+    const __m256i max_control = _mm256_set1_epi16(31);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i tab = _mm256_set1_epi16(9);
+    const __m256i vt  = _mm256_set1_epi16(11);
+    const __m256i ff  = _mm256_set1_epi16(12);
+    for(; i + 16 <= unit_count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + 2*i));
+        if(big_endian) {
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        }
+        __m256i control = _mm256_cmpeq_epi16(_mm256_subs_epu16(v, max_control), zero);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi16(v, tab),
+                          _mm256_or_si256(_mm256_cmpeq_epi16(v, vt), _mm256_cmpeq_epi16(v, ff)));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_andnot_si256(allowed, control));
+        if(mask) {
+            return i + lowest_set_bit_index(mask) / 2;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i max_control = _mm_set1_epi16(31);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tab = _mm_set1_epi16(9);
+    const __m128i vt  = _mm_set1_epi16(11);
+    const __m128i ff  = _mm_set1_epi16(12);
+    for(; i + 8 <= unit_count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 2*i));
+        if(big_endian) {
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+        __m128i control = _mm_cmpeq_epi16(_mm_subs_epu16(v, max_control), zero);
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi16(v, tab),
+                          _mm_or_si128(_mm_cmpeq_epi16(v, vt), _mm_cmpeq_epi16(v, ff)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_andnot_si128(allowed, control));
+        if(mask) {
+            return i + lowest_set_bit_index(mask) / 2;
+        }
+    }
+#endif
+
+    for(; i < unit_count; ++i) {
+        if(is_special_code(read_code_unit(p + 2*i, big_endian))) {
+            return i;
+        }
+    }
+    return unit_count;
+}
+
+
+// Classifies a block of 64 bytes at once : bit i of each mask tells about byte p[i].
+//    cr      : the byte is 13
+//    lf      : the byte is 10
+//    special : the byte is special (so this includes cr and lf)
+
+#define BYTE_BLOCK_SIZE 64
+
+typedef struct {
+    uint64_t cr;
+    uint64_t lf;
+    uint64_t special;
+} Byte_block_masks;
+
+static inline void
+classify_byte_block(const BYTE *p, Byte_block_masks *m)
+{
+#if defined(__AVX2__)
+    const __m256i max_control = _mm256_set1_epi8(31);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i cr  = _mm256_set1_epi8(13);
+    const __m256i lf  = _mm256_set1_epi8(10);
+    const __m256i tab = _mm256_set1_epi8(9);
+    const __m256i vt  = _mm256_set1_epi8(11);
+    const __m256i ff  = _mm256_set1_epi8(12);
+    m->cr = m->lf = m->special = 0;
+    for(int half=0; half<2; ++half) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32*half));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_subs_epu8(v, max_control), zero);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                          _mm256_or_si256(_mm256_cmpeq_epi8(v, vt), _mm256_cmpeq_epi8(v, ff)));
+        int shift = 32*half;
+        m->cr |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr)) << shift;
+        m->lf |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf)) << shift;
+        m->special |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(allowed, control)) << shift;
+    }
+#elif defined(__SSE2__)
+    const __m128i max_control = _mm_set1_epi8(31);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i cr  = _mm_set1_epi8(13);
+    const __m128i lf  = _mm_set1_epi8(10);
+    const __m128i tab = _mm_set1_epi8(9);
+    const __m128i vt  = _mm_set1_epi8(11);
+    const __m128i ff  = _mm_set1_epi8(12);
+    m->cr = m->lf = m->special = 0;
+    for(int quarter=0; quarter<4; ++quarter) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16*quarter));
+        __m128i control = _mm_cmpeq_epi8(_mm_subs_epu8(v, max_control), zero);
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+                          _mm_or_si128(_mm_cmpeq_epi8(v, vt), _mm_cmpeq_epi8(v, ff)));
+        int shift = 16*quarter;
+        m->cr |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr)) << shift;
+        m->lf |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)) << shift;
+        m->special |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_andnot_si128(allowed, control)) << shift;
+    }
+#else
+    m->cr = m->lf = m->special = 0;
+    for(int i=0; i<BYTE_BLOCK_SIZE; ++i) {
+        if(is_special_code(p[i])) {
+            uint64_t bit = (uint64_t)1 << i;
+            m->special |= bit;
+            if(p[i] == 13) {
+                m->cr |= bit;
+            } else if(p[i] == 10) {
+                m->lf |= bit;
+            }
+        }
+    }
+#endif
+}
+
+
+#endif
@@ -0,0 +1,284 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for splice, tee and F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include "endlines.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// SEE endlines.h FOR INTERFACE DOCUMENTATION
+
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+
+#include <pthread.h>
+
+// How it goes :
+//
+// The input pipe's contents are duplicated by tee into a pipe of our own (the passthrough pipe),
+// then read, and scanned up to the first line ending that is not in the destination convention.
+// The conforming part is spliced from the passthrough pipe to the output : tee and splice only
+// pass page references around, so the bytes themselves are copied once, by read, rather than
+// twice, by read and then write.
+//
+// Once a line ending needs converting, what's left in the passthrough pipe is the input from
+// that line ending on. A thread then keeps splicing the rest of the input after it, and
+// convert_stream reads the passthrough pipe as its input, up to the end.
+//
+// Converting into CR-LF or CR, a 13 at the very end of what's been read can't be told apart
+// from the beginning of a CR-LF, until more is read : it's then held back in the passthrough
+// pipe, and scanned again along with what comes next. So are the first bytes of the input,
+// until there are enough of them to tell whether they start with a BOM.
+//
+// Some outputs won't take splice, such as files opened for appending : the conforming part is
+// then read back from the passthrough pipe and written out instead.
+
+typedef struct {
+    int in;
+    int out;
+    bool error;
+} Pump;
+
+static void *
+run_pump(void *p_pump)
+{
+    Pump *pump = (Pump *)p_pump;
+    BYTE buffer[BUFFERSIZE];
+    for(;;) {
+        ssize_t moved = splice(pump->in, NULL, pump->out, NULL, MAX_DEFAULT_BUFFER_SIZE, SPLICE_F_MOVE);
+        if(moved < 0 && errno == EINVAL) {   // not spliceable after all : copying then
+            moved = read(pump->in, buffer, BUFFERSIZE);
+            if(moved > 0 && !write_all(pump->out, buffer, (size_t)moved)) {
+                moved = -1;
+            }
+        }
+        if(moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if(moved <= 0) {
+            pump->error = (moved < 0);
+            break;
+        }
+    }
+    close(pump->out);
+    return NULL;
+}
+
+static bool
+read_all(int fd, BYTE *buffer, size_t count)
+{
+    while(count > 0) {
+        ssize_t got = read(fd, buffer, count);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            return false;
+        }
+        buffer += got;
+        count -= (size_t)got;
+    }
+    return true;
+}
+
+// Moves count bytes from the passthrough pipe to out. If out won't take splice at all, clears
+// can_splice and copies them through buffer instead, from then on. Returns true upon success.
+static bool
+splice_all(int passthrough, int out, size_t count, BYTE *buffer, bool *can_splice)
+{
+    size_t moved_so_far = 0;
+    while(*can_splice && moved_so_far < count) {
+        ssize_t moved = splice(passthrough, NULL, out, NULL, count - moved_so_far, SPLICE_F_MOVE);
+        if(moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if(moved < 0 && moved_so_far == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            *can_splice = false;
+            break;
+        }
+        if(moved <= 0) {
+            return false;
+        }
+        moved_so_far += (size_t)moved;
+    }
+    if(*can_splice) {
+        return true;
+    }
+    // the passthrough pipe holds the same bytes as the start of buffer
+    return read_all(passthrough, buffer, count) && write_all(out, buffer, count);
+}
+
+
+// Converts the rest of the input, that starts with what's left in the passthrough pipe.
+static Conversion_Report
+convert_rest(Conversion_Parameters p, int passthrough[2], Encoding_layout layout)
+{
+    Pump pump = {.in=p.in_fd, .out=passthrough[1], .error=false};
+    pthread_t thread;
+    bool started = !pthread_create(&thread, NULL, run_pump, &pump);
+    if(!started) {
+        close(passthrough[1]);
+    }
+    p.in_fd = passthrough[0];
+    p.encoding_layout = layout;
+    Conversion_Report report = convert_stream(p);
+    if(started) {
+        pthread_join(thread, NULL);
+    }
+    report.error_during_conversion = report.error_during_conversion || pump.error || !started;
+    return report;
+}
+
+
+Conversion_Report
+convert_stream_spliced(Conversion_Parameters p)
+{
+    struct stat in_info, out_info;
+    if(p.in_memory != NULL || p.out_fd == NO_FD || p.interrupt_if_not_like_dst_convention ||
+       fstat(p.in_fd, &in_info) || !S_ISFIFO(in_info.st_mode) ||
+       fstat(p.out_fd, &out_info) || !(S_ISFIFO(out_info.st_mode) || S_ISREG(out_info.st_mode)) ||
+       (fcntl(p.out_fd, F_GETFL) & O_APPEND)) {
+        return convert_stream(p);
+    }
+    int passthrough[2];
+    if(pipe(passthrough)) {
+        return convert_stream(p);
+    }
+    size_t chunk_size = p.buffer_size ? p.buffer_size : BUFFERSIZE;
+    int pipe_size = fcntl(passthrough[1], F_SETPIPE_SZ, (int)chunk_size);
+    if(pipe_size > 0 && (size_t)pipe_size < chunk_size) {
+        chunk_size = (size_t)pipe_size;
+    }
+    BYTE *buffer = malloc(chunk_size);
+    if(buffer == NULL) {
+        close(passthrough[0]);
+        close(passthrough[1]);
+        return convert_stream(p);
+    }
+
+    Conversion_Report report;
+    memset(&report, 0, sizeof(report));
+    report.encoding_layout = WT_1BYTE;
+    Encoding_layout layout = DETECT_LAYOUT;    // until the first chunk tells
+    size_t held_back = 0;
+    bool done = false;
+    bool error = false;
+    bool can_splice = true;
+
+    while(!done && !error) {
+        ssize_t teed;
+        do {
+            teed = tee(p.in_fd, passthrough[1], chunk_size - held_back, 0);
+        } while(teed < 0 && errno == EINTR);
+        if(teed < 0 || !read_all(p.in_fd, buffer + held_back, (size_t)teed)) {
+            if(teed < 0 && errno == EINVAL && layout == DETECT_LAYOUT) {
+                break;    // tee isn't supported : all that's been taken is in the passthrough pipe
+            }
+            error = true;
+            break;
+        }
+        size_t size = held_back + (size_t)teed;
+        if(teed == 0) {
+            done = (held_back == 0);   // or else a final 13, or a lone first byte, is left
+            break;
+        }
+        if(layout == DETECT_LAYOUT && size < BOM_SIZE) {
+            held_back = size;   // not enough to tell a BOM yet
+            continue;
+        }
+
+        Conversion_Parameters scan = {
+            .in_fd=NO_FD,
+            .in_memory=buffer,
+            .in_memory_size=size,
+            .encoding_layout=layout,
+            .out_fd=NO_FD,
+            .dst_convention=p.dst_convention,
+            .interrupt_if_not_like_dst_convention=true,
+            .interrupt_if_non_text=p.interrupt_if_non_text
+        };
+        Conversion_Report scan_report = convert_stream(scan);
+        if(scan_report.encoding_layout != WT_1BYTE) {
+            break;   // only the first chunk can tell so : it's all left in the passthrough pipe
+        }
+        layout = WT_1BYTE;
+        size_t conforming = (size_t)scan_report.conforming_prefix_length;
+        bool hold_back_13 = buffer[size-1] == 13 && p.dst_convention != LF && conforming + 1 >= size;
+        if(hold_back_13 && conforming == size) {
+            // converting into CR, the scan took it for a lone CR : it'll be counted along with what comes next
+            -- scan_report.count_by_convention[CR];
+            conforming = size - 1;
+            scan_report.conforming_prefix_length = (off_t)conforming;
+        }
+        if(!splice_all(passthrough[0], p.out_fd, conforming, buffer, &can_splice)) {
+            error = true;
+            break;
+        }
+        append_report(&report, &scan_report);
+        report.encoding_layout = WT_1BYTE;
+
+        held_back = 0;
+        if(hold_back_13) {
+            buffer[0] = 13;
+            held_back = 1;
+        } else if(conforming < size) {
+            break;
+        }
+    }
+    free(buffer);
+
+    if(!done && !error) {
+        Conversion_Report rest_report = convert_rest(p, passthrough, layout);
+        if(layout == DETECT_LAYOUT) {
+            report = rest_report;
+        } else {
+            append_report(&report, &rest_report);
+        }
+    } else {
+        if(done && p.final_char_has_to_be_eol && !report.has_final_eol) {
+            BYTE newline[MAX_NEWLINE_SIZE];
+            size_t newline_size = encode_newline(p.dst_convention, WT_1BYTE, newline);
+            error = error || !write_all(p.out_fd, newline, newline_size);
+            report.has_final_eol = true;
+        }
+        close(passthrough[1]);
+    }
+    close(passthrough[0]);
+    report.error_during_conversion = report.error_during_conversion || error;
+    return report;
+}
+
+
+#else
+
+
+Conversion_Report
+convert_stream_spliced(Conversion_Parameters p)
+{
+    return convert_stream(p);
+}
+
+
+#endif
@@ -0,0 +1,319 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for syscall and posix_fadvise's constants
+#define _GNU_SOURCE
+
+#include "uring_reader.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// SEE uring_reader.h FOR INTERFACE DOCUMENTATION
+
+
+// io_uring is talked to through its raw system calls, so as not to depend on liburing.
+// IORING_FEAT_FAST_POLL tells the kernel headers are recent enough (5.7) to know about
+// all the operations used here.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_FAST_POLL
+#define HAS_IO_URING
+#endif
+#endif
+#endif
+
+
+#ifdef HAS_IO_URING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Each file of a batch has no more than two operations in flight at once :
+// an fadvise, and the close that is linked to it.
+#define RING_ENTRIES (2*URING_BATCH_SIZE)
+#define SLOT_SIZE (URING_MAX_FILE_SIZE + 1)
+
+struct Uring_reader {
+    int ring_fd;
+    bool broken;            // a call to io_uring_enter failed : the ring can't be trusted anymore
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;          // may be the same mapping as sq_ring
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    BYTE *slots;            // URING_BATCH_SIZE slots of SLOT_SIZE bytes, one per file of a batch
+    int fds[URING_BATCH_SIZE];
+};
+
+
+static bool
+supports_needed_operations(int ring_fd)
+{
+    const BYTE needed_operations[] = {
+        IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_FADVISE, IORING_OP_CLOSE
+    };
+    size_t probe_size = sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if(probe == NULL) {
+        return false;
+    }
+    bool supported = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for(size_t i=0; supported && i<sizeof(needed_operations); ++i) {
+        BYTE op = needed_operations[i];
+        supported = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+
+Uring_reader *
+new_uring_reader()
+{
+    Uring_reader *r = calloc(1, sizeof(Uring_reader));
+    if(r == NULL) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->ring_fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if(r->ring_fd < 0) {
+        free(r);
+        return NULL;
+    }
+
+    r->sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mapping && r->cq_ring_size > r->sq_ring_size) {
+        r->sq_ring_size = r->cq_ring_size;
+    }
+    r->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_SQ_RING);
+    r->cq_ring = single_mapping ? r->sq_ring :
+                 mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->ring_fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    r->slots = malloc(URING_BATCH_SIZE * (size_t)SLOT_SIZE);
+    if(r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED ||
+       r->slots == NULL || !supports_needed_operations(r->ring_fd)) {
+        destroy_uring_reader(r);
+        return NULL;
+    }
+
+    BYTE *sq = r->sq_ring;
+    BYTE *cq = r->cq_ring;
+    r->sq_tail  = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return r;
+}
+
+
+void
+destroy_uring_reader(Uring_reader *r)
+{
+    if(r == NULL) {
+        return;
+    }
+    if(r->sqes != NULL && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if(r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if(r->sq_ring != NULL && r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    close(r->ring_fd);
+    free(r->slots);
+    free(r);
+}
+
+
+
+// SUBMITTING AND COMPLETING
+// Operations of a phase are queued, then submitted all at once, and the phase waits for all
+// of them to complete. Each operation's user_data is the index where its result goes.
+
+static struct io_uring_sqe *
+queue_operation(Uring_reader *r, unsigned queued, BYTE opcode, int fd, uint64_t user_data)
+{
+    unsigned index = (*r->sq_tail + queued) & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    r->sq_array[index] = index;
+    return sqe;
+}
+
+static void
+submit_and_wait(Uring_reader *r, unsigned count, int *results)
+{
+    __atomic_store_n(r->sq_tail, *r->sq_tail + count, __ATOMIC_RELEASE);
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    while(completed < count) {
+        long ret = syscall(__NR_io_uring_enter, r->ring_fd, count - submitted, 1,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            r->broken = true;
+            return;
+        }
+        submitted += (unsigned)ret;
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head, ++completed) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            results[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+
+void
+read_batch(Uring_reader *r, Uring_read_item *items, int count)
+{
+    int results[RING_ENTRIES];
+    for(int i=0; i<count; ++i) {
+        items[i].contents = r->slots + (size_t)i*SLOT_SIZE;
+        items[i].size = 0;
+        items[i].ok = false;
+        r->fds[i] = -1;
+    }
+    if(r->broken) {
+        return;
+    }
+
+    unsigned queued = 0;
+    for(int i=0; i<count; ++i) {
+        struct io_uring_sqe *sqe = queue_operation(r, queued++, IORING_OP_OPENAT, AT_FDCWD, i);
+        sqe->addr = (uint64_t)(uintptr_t)items[i].filename;
+        sqe->open_flags = O_RDONLY;
+        results[i] = -1;
+    }
+    submit_and_wait(r, queued, results);
+    for(int i=0; i<count; ++i) {
+        r->fds[i] = results[i] >= 0 ? results[i] : -1;
+    }
+    if(r->broken) {
+        goto close_files;
+    }
+
+    queued = 0;
+    for(int i=0; i<count; ++i) {
+        if(r->fds[i] >= 0) {
+            struct io_uring_sqe *sqe = queue_operation(r, queued++, IORING_OP_READ, r->fds[i], i);
+            sqe->addr = (uint64_t)(uintptr_t)items[i].contents;
+            sqe->len = SLOT_SIZE;
+            sqe->off = 0;
+        }
+        results[i] = -1;
+    }
+    submit_and_wait(r, queued, results);
+    for(int i=0; i<count; ++i) {
+        if(results[i] >= 0 && !r->broken) {
+            items[i].size = (size_t)results[i];
+            items[i].ok = items[i].size <= URING_MAX_FILE_SIZE &&
+                          (off_t)items[i].size == items[i].expected_size;
+        }
+    }
+
+    close_files:
+    queued = 0;
+    if(!r->broken) {
+        for(int i=0; i<count; ++i) {
+            if(r->fds[i] >= 0) {
+                struct io_uring_sqe *sqe = queue_operation(r, queued++, IORING_OP_FADVISE,
+                                                           r->fds[i], 2*i);
+                sqe->fadvise_advice = POSIX_FADV_DONTNEED;
+                sqe->flags = IOSQE_IO_LINK;
+                queue_operation(r, queued++, IORING_OP_CLOSE, r->fds[i], 2*i + 1);
+            }
+            results[2*i + 1] = -ECANCELED;
+        }
+        submit_and_wait(r, queued, results);
+    }
+    // Whatever didn't get closed through the ring is closed the usual way.
+    for(int i=0; i<count; ++i) {
+        if(r->fds[i] >= 0 && (r->broken || results[2*i + 1] == -ECANCELED)) {
+            close(r->fds[i]);
+        }
+    }
+}
+
+
+#else
+
+
+Uring_reader *
+new_uring_reader()
+{
+    return NULL;
+}
+
+void
+destroy_uring_reader(Uring_reader *reader)
+{
+}
+
+void
+read_batch(Uring_reader *reader, Uring_read_item *items, int count)
+{
+    for(int i=0; i<count; ++i) {
+        items[i].contents = NULL;
+        items[i].size = 0;
+        items[i].ok = false;
+    }
+}
+
+
+#endif
@@ -0,0 +1,75 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _URING_READER_H_
+#define _URING_READER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef BYTE
+#define BYTE unsigned char
+#endif
+
+//
+// The uring reader : reads a whole batch of small files at once, through io_uring.
+//
+// Handling one small file at a time, the time goes to syscall round trips rather than to
+// the bytes : open, read, fadvise, close. The uring reader submits each of these steps
+// for a whole batch of files in one go, so that there are a few round trips per batch.
+//
+// Only available on Linux kernels that support the needed io_uring operations (5.6 and later).
+// Elsewhere new_uring_reader returns NULL, and files should be read one by one as usual.
+//
+
+// Number of files in a batch.
+#define URING_BATCH_SIZE 64
+
+// Largest file that goes into a batch : each file of a batch gets a slot of this size,
+// plus one byte to notice files that have grown since they were stat'ed.
+#define URING_MAX_FILE_SIZE 65536
+
+
+// One file of a batch.
+// The caller sets filename and expected_size ; read_batch fills in the rest.
+typedef struct {
+    const char *filename;
+    off_t expected_size;
+
+    BYTE *contents;          // points into the reader's own memory, valid until the next batch
+    size_t size;
+    bool ok;                 // false if the file couldn't be read whole, or had changed size :
+                             // the caller should then handle it the usual way
+} Uring_read_item;
+
+
+typedef struct Uring_reader Uring_reader;
+
+
+// Returns NULL if io_uring isn't available.
+Uring_reader *new_uring_reader();
+
+void destroy_uring_reader(Uring_reader *reader);
+
+// Reads count files (no more than URING_BATCH_SIZE), each no larger than URING_MAX_FILE_SIZE.
+// Files are advised out of the page cache once read, as with close_dropping_cache.
+void read_batch(Uring_reader *reader, Uring_read_item *items, int count);
+
+
+#endif
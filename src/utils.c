@@ -17,9 +17,14 @@
    limitations under the License.
 */
 
+// for pthread_once
+#define _POSIX_C_SOURCE 200809L
+
 #include "endlines.h"
 #include "known_binary_extensions.h"
 
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -45,6 +50,22 @@ get_source_convention(Conversion_Report *file_report)
 }
 
 
+void
+append_report(Conversion_Report *report, Conversion_Report *following_report)
+{
+    for(int i=0; i<CONVENTIONS_COUNT; i++) {
+        report->count_by_convention[i] += following_report->count_by_convention[i];
+    }
+    report->error_during_conversion = report->error_during_conversion ||
+                                      following_report->error_during_conversion;
+    report->contains_non_text_chars = report->contains_non_text_chars ||
+                                      following_report->contains_non_text_chars;
+    report->has_final_eol = following_report->has_final_eol;
+    report->stopped_at_nonconforming_eol = following_report->stopped_at_nonconforming_eol;
+    report->conforming_prefix_length += following_report->conforming_prefix_length;
+}
+
+
 static char*
 get_file_extension(char *name)
 {
@@ -60,16 +81,122 @@ get_file_extension(char *name)
 }
 
 
+// Known binary extensions are kept in lower case, in an open addressing hash table :
+// looking an extension up takes one hash, and most often one string comparison.
+// The table is filled with known_binary_file_extensions on first use.
+
+#define EXTENSIONS_TABLE_SIZE 1024  // a power of two ; kept at most half full
+
+static char extensions_table[EXTENSIONS_TABLE_SIZE][MAX_BINARY_EXTENSION_LENGTH+1];
+static int extensions_table_count = 0;
+static pthread_once_t extensions_table_filled = PTHREAD_ONCE_INIT;
+
+
+// Copies extension into lower_case, in lower case, and sets *hash (FNV-1a) as it goes.
+// Returns false if extension is empty, or too long to be in the table.
+static bool
+lower_case_extension(const char *extension, char *lower_case, unsigned int *hash)
+{
+    unsigned int h = 2166136261u;
+    int i;
+    for(i=0; extension[i] != 0; ++i) {
+        if(i == MAX_BINARY_EXTENSION_LENGTH) {
+            return false;
+        }
+        char c = extension[i];
+        if(c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        lower_case[i] = c;
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    lower_case[i] = 0;
+    *hash = h;
+    return i > 0;
+}
+
+// Returns the table slot that holds extension, or the empty slot where it would go.
+static char *
+find_extensions_table_slot(const char *lower_case, unsigned int hash)
+{
+    unsigned int slot = hash & (EXTENSIONS_TABLE_SIZE - 1);
+    while(extensions_table[slot][0] != 0 && strcmp(extensions_table[slot], lower_case)) {
+        slot = (slot + 1) & (EXTENSIONS_TABLE_SIZE - 1);
+    }
+    return extensions_table[slot];
+}
+
+static bool
+add_to_extensions_table(const char *extension)
+{
+    char lower_case[MAX_BINARY_EXTENSION_LENGTH+1];
+    unsigned int hash;
+    if(!lower_case_extension(extension, lower_case, &hash)) {
+        return false;
+    }
+    char *slot = find_extensions_table_slot(lower_case, hash);
+    if(slot[0] == 0) {
+        if(extensions_table_count == EXTENSIONS_TABLE_SIZE / 2) {
+            return false;
+        }
+        strcpy(slot, lower_case);
+        ++ extensions_table_count;
+    }
+    return true;
+}
+
+static void
+fill_extensions_table()
+{
+    for(int i=0; i<known_binary_file_extensions_count; i++) {
+        add_to_extensions_table(known_binary_file_extensions[i]);
+    }
+}
+
+
 bool
 has_known_binary_file_extension(char *filename)
 {
-    char *ext = get_file_extension(filename);
-    for(int i=0; i<known_binary_file_extensions_count; i++) {
-        if( !strcmp(ext, known_binary_file_extensions[i]) ) {
-            return true;
+    pthread_once(&extensions_table_filled, fill_extensions_table);
+    char lower_case[MAX_BINARY_EXTENSION_LENGTH+1];
+    unsigned int hash;
+    if(!lower_case_extension(get_file_extension(filename), lower_case, &hash)) {
+        return false;
+    }
+    return find_extensions_table_slot(lower_case, hash)[0] != 0;
+}
+
+
+bool
+load_known_binary_file_extensions(const char *filename)
+{
+    pthread_once(&extensions_table_filled, fill_extensions_table);
+    FILE *f = fopen(filename, "r");
+    if(f == NULL) {
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), f) != NULL) {
+        char *extension = line;
+        while(*extension == ' ' || *extension == '\t') {
+            ++ extension;
+        }
+        if(*extension == '.') {
+            ++ extension;
+        }
+        size_t length = strlen(extension);
+        while(length > 0 && (extension[length-1] == '\n' || extension[length-1] == '\r' ||
+                             extension[length-1] == ' ' || extension[length-1] == '\t')) {
+            extension[--length] = 0;
+        }
+        if(length > 0 && extension[0] != '#') {
+            ok = add_to_extensions_table(extension);
         }
     }
-    return false;
+    ok = ok && !ferror(f);
+    fclose(f);
+    return ok;
 }
 
 
@@ -91,12 +218,34 @@ display_help_and_quit()
                     "  General   -f / --final    : add final EOL if none.\n"
                     "            -q / --quiet    : silence all but the error messages.\n"
                     "            -v / --verbose  : print more about what's going on.\n"
-                    "            --version       : print version and license.\n\n"
+                    "            --version       : print version and license.\n"
+                    "            --buffer-size=N : read and write N bytes at a time (e.g. 256K or 4M).\n"
+                    "                              By default it's picked per file.\n"
+                    "            -j / --jobs N   : process N files at a time,\n"
+                    "                              and large files N chunks at a time.\n"
+                    "                              From stdin, reads and writes on threads of their own.\n\n"
 
                     "  Files     -b / --binaries : don't skip binary files.\n"
+                    "            --binary-extensions=FILE\n"
+                    "                            : also skip files whose extension is listed in FILE,\n"
+                    "                              one per line.\n"
+                    "            --cache=FILE    : remember in FILE what was found out about each file,\n"
+                    "                              and answer unchanged files from there next time.\n"
+                    "            --files-from=FILE\n"
+                    "                            : also process the files listed in FILE (- for stdin),\n"
+                    "                              separated by NULs or newlines.\n"
+                    "            --git           : process the files git tracks in the working trees\n"
+                    "                              given as FILES (by default the current directory).\n"
+                    "            --git-changed   : same, but only those changed since git last saw them.\n"
                     "            -h / --hidden   : process hidden files (/directories) too.\n"
+                    "            -i / --inplace  : rewrite files in place when converting to lf or cr,\n"
+                    "                              instead of through a temporary copy.\n"
+                    "                              Keeps hard links, but isn't safe against interruptions.\n"
                     "            -k / --keepdate : keep last modified and last access times.\n"
-                    "            -r / --recurse  : recurse into directories.\n\n"
+                    "            -r / --recurse  : recurse into directories.\n"
+                    "            --watch         : once done, keep processing files as they're written to,\n"
+                    "                              in the directories given as FILES. Implies -r.\n"
+                    "                              Linux only.\n\n"
 
                     "  Examples  %s check *.txt\n"
                     "            %s linux -kr aFolder anotherFolder\n\n",
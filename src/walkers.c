@@ -17,11 +17,26 @@
 */
 
 
+// for pthreads, strdup, dirfd and fstatat
+#define _POSIX_C_SOURCE 200809L
+// for d_type's DT_ values, where there are some, and syscall
+#define _DEFAULT_SOURCE
+
 #include "walkers.h"
+#include "git_index.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 
 Walk_tracker
@@ -58,10 +73,14 @@ found_an_unreadable_file(char *filename, Walk_tracker *tracker)
     ++ tracker->read_errors_count;
 }
 
+static void queue_directory(char *directory_name, Walk_tracker *tracker);
+
 static void
 found_a_directory(char *filename, Walk_tracker *tracker)
 {
-    if(tracker->recurse) {
+    if(tracker->recurse && tracker->walker_thread != NULL) {
+        queue_directory(filename, tracker);
+    } else if(tracker->recurse) {
         walk_directory(filename, tracker);
     } else {
         if(tracker->verbose) {
@@ -121,21 +140,143 @@ is_hidden_filename(char *filename)
     return false; // to silence compiler errors, but should never be reached
 }
 
+static void
+found_a_stated_item(char *filename, struct stat *statinfo, Walk_tracker *tracker)
+{
+    if(S_ISDIR(statinfo->st_mode)) {
+        found_a_directory(filename, tracker);
+    } else if(S_ISREG(statinfo->st_mode)) {
+        found_a_file_that_needs_processing(filename, statinfo, tracker);
+    }
+}
+
+static void walk_in_parallel(char **filenames, int file_count, Walk_tracker *tracker);
+
 void
 walk_filenames(char **filenames, int file_count, Walk_tracker *tracker)
 {
+    if(tracker->threads > 1 && tracker->recurse && tracker->walker_thread == NULL) {
+        walk_in_parallel(filenames, file_count, tracker);
+        return;
+    }
     struct stat statinfo;
     for(int i=0; i<file_count; ++i) {
         if(is_hidden_filename(filenames[i]) && tracker->skip_hidden) {
             skip_a_hidden_file(filenames[i], tracker);
         } else if(stat(filenames[i], &statinfo)) {
             found_an_unreadable_file(filenames[i], tracker);
-        } else if(S_ISDIR(statinfo.st_mode)) {
-            found_a_directory(filenames[i], tracker);
-        } else if(S_ISREG(statinfo.st_mode)) {
-            found_a_file_that_needs_processing(filenames[i], &statinfo, tracker);
+        } else {
+            found_a_stated_item(filenames[i], &statinfo, tracker);
+        }
+    }
+}
+
+
+// Names are read from the list into a batch, and handed to walk_filenames a batch at a time.
+// A name longer than a whole batch is walked on its own.
+
+#define FILENAME_BATCH_SIZE (64*1024)
+#define FILENAME_BATCH_MAX_COUNT 1024
+
+typedef struct {
+    char names[FILENAME_BATCH_SIZE];
+    size_t used;
+    char *filenames[FILENAME_BATCH_MAX_COUNT];
+    int count;
+} Filename_batch;
+
+static void
+walk_filename_batch(Filename_batch *batch, Walk_tracker *tracker)
+{
+    walk_filenames(batch->filenames, batch->count, tracker);
+    batch->used = 0;
+    batch->count = 0;
+}
+
+static void
+add_to_filename_batch(char *name, size_t length, Filename_batch *batch, Walk_tracker *tracker)
+{
+    if(batch->count == FILENAME_BATCH_MAX_COUNT || batch->used + length + 1 > FILENAME_BATCH_SIZE) {
+        walk_filename_batch(batch, tracker);
+    }
+    if(length + 1 > FILENAME_BATCH_SIZE) {
+        walk_filenames(&name, 1, tracker);
+        return;
+    }
+    char *copy = &(batch->names[batch->used]);
+    memcpy(copy, name, length + 1);
+    batch->used += length + 1;
+    batch->filenames[batch->count++] = copy;
+}
+
+// The first name ends with the first NUL or newline : that's the separator for the others.
+static int
+read_first_listed_name(FILE *list, char **name, size_t *capacity, ssize_t *length)
+{
+    *length = 0;
+    int c;
+    while((c = getc(list)) != EOF && c != 0 && c != '\n') {
+        if((size_t)*length + 1 >= *capacity) {
+            size_t new_capacity = *capacity ? 2 * *capacity : 256;
+            char *grown = realloc(*name, new_capacity);
+            if(grown == NULL) {
+                return EOF;
+            }
+            *name = grown;
+            *capacity = new_capacity;
         }
+        (*name)[(*length)++] = (char)c;
+    }
+    if(*name != NULL) {
+        (*name)[*length] = 0;
+    }
+    return c == 0 ? 0 : '\n';
+}
+
+void
+walk_filename_list(FILE *list, Walk_tracker *tracker)
+{
+    Filename_batch *batch = malloc(sizeof(Filename_batch));
+    if(batch == NULL) {
+        fprintf(stdout, "%s : can't allocate memory\n", tracker->program_name);
+        ++ tracker->read_errors_count;
+        return;
+    }
+    batch->used = 0;
+    batch->count = 0;
+
+    char *name = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int separator = read_first_listed_name(list, &name, &capacity, &length);
+    if(separator == EOF) {
+        fprintf(stdout, "%s : can't allocate memory\n", tracker->program_name);
+        ++ tracker->read_errors_count;
+        free(name);
+        free(batch);
+        return;
+    }
+    bool first = true;
+    while(first || (length = getdelim(&name, &capacity, separator, list)) >= 0) {
+        first = false;
+        if(length > 0 && name[length-1] == separator) {
+            name[--length] = 0;
+        }
+        // Lists written on Windows
+        if(separator == '\n' && length > 0 && name[length-1] == '\r') {
+            name[--length] = 0;
+        }
+        if(length > 0) {
+            add_to_filename_batch(name, (size_t)length, batch, tracker);
+        }
+    }
+    walk_filename_batch(batch, tracker);
+    if(ferror(list)) {
+        fprintf(stdout, "%s : could not read the whole list of files\n", tracker->program_name);
+        ++ tracker->read_errors_count;
     }
+    free(name);
+    free(batch);
 }
 
 
@@ -194,6 +335,110 @@ prepare_to_walk_a_directory(char *directory_name, int dirname_length,
     return 0;
 }
 
+// The entry's type, when the file system tells it along with its name, is enough to
+// skip what's neither a directory nor a regular file, and to walk directories.
+// Regular files need their stat info, and symbolic links need following : they're stated
+// relative to the directory, which spares the kernel resolving the whole path again.
+// type is the entry's d_type, where there's one.
+static void
+walk_directory_entry(int directory_fd, char *name, int type, char *file_path, Walk_tracker *tracker)
+{
+#ifdef DT_UNKNOWN
+    switch(type) {
+    case DT_DIR:
+        found_a_directory(file_path, tracker);
+        return;
+    case DT_REG:
+    case DT_LNK:
+    case DT_UNKNOWN:
+        break;
+    default:
+        return;
+    }
+#endif
+    struct stat statinfo;
+    if(fstatat(directory_fd, name, &statinfo, 0)) {
+        found_an_unreadable_file(file_path, tracker);
+    } else {
+        found_a_stated_item(file_path, &statinfo, tracker);
+    }
+}
+
+// file_path_buffer holds the directory's name, that's dirname_length long.
+static void
+walk_named_directory_entry(int directory_fd, char *name, int type,
+                           char *file_path_buffer, int dirname_length, Walk_tracker *tracker)
+{
+    reset_base_path_termination(file_path_buffer, dirname_length);
+    if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return;
+    }
+    if(append_filename_to_base_path(file_path_buffer, dirname_length, name, tracker)) {
+        return;
+    }
+    if(name[0] == '.' && tracker->skip_hidden) {
+        skip_a_hidden_file(file_path_buffer, tracker);
+    } else {
+        walk_directory_entry(directory_fd, name, type, file_path_buffer, tracker);
+    }
+}
+
+
+#if defined(__linux__) && defined(SYS_getdents64)
+
+// On Linux, directories are read with getdents64 straight into a buffer of our own, much
+// larger than readdir's : huge directories take far fewer system calls. Entries are walked
+// right where the kernel put them. Whatever the directory's size, only one buffer's worth
+// of entries is held at a time, per directory being walked. The buffer's pages that a small
+// directory doesn't fill are never touched.
+
+#define DIRECTORY_READ_BUFFER_SIZE (1024*1024)
+
+// The layout getdents64 writes entries in
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} Linux_dirent64;
+
+typedef enum {
+    BULK_WALK_DONE, BULK_WALK_FAILED_TO_OPEN, BULK_WALK_NOT_AVAILABLE
+} Bulk_walk_outcome;
+
+static Bulk_walk_outcome
+walk_directory_in_bulk(char *directory_name, char *file_path_buffer, int dirname_length,
+                       Walk_tracker *tracker)
+{
+    int directory_fd = open(directory_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directory_fd < 0) {
+        return BULK_WALK_FAILED_TO_OPEN;
+    }
+    char *buffer = malloc(DIRECTORY_READ_BUFFER_SIZE);
+    if(buffer == NULL) {
+        close(directory_fd);
+        return BULK_WALK_NOT_AVAILABLE;
+    }
+    bool first_read = true;
+    long got;
+    while((got = syscall(SYS_getdents64, directory_fd, buffer, DIRECTORY_READ_BUFFER_SIZE)) > 0) {
+        first_read = false;
+        for(long offset = 0; offset < got; ) {
+            Linux_dirent64 *entry = (Linux_dirent64 *)(buffer + offset);
+            walk_named_directory_entry(directory_fd, entry->d_name, entry->d_type,
+                                       file_path_buffer, dirname_length, tracker);
+            offset += entry->d_reclen;
+        }
+    }
+    free(buffer);
+    close(directory_fd);
+    return (got < 0 && first_read && errno == ENOSYS) ? BULK_WALK_NOT_AVAILABLE : BULK_WALK_DONE;
+}
+
+#endif
+
+
 void
 walk_directory(char *directory_name, Walk_tracker *tracker)
 {
@@ -202,20 +447,340 @@ walk_directory(char *directory_name, Walk_tracker *tracker)
     DIR *pdir;
 
     int dirname_length = strlen(directory_name);
+    if(tracker->enter_directory != NULL) {
+        tracker->enter_directory(directory_name, tracker->enter_directory_context);
+    }
+#if defined(__linux__) && defined(SYS_getdents64)
+    if(dirname_length+1 < WALKERS_MAX_PATH_LENGTH) {
+        strcpy(file_path_buffer, directory_name);
+        switch(walk_directory_in_bulk(directory_name, file_path_buffer, dirname_length, tracker)) {
+        case BULK_WALK_DONE:
+            return;
+        case BULK_WALK_FAILED_TO_OPEN:
+            fprintf(stdout, "%s : can not open directory %s\n", tracker->program_name, directory_name);
+            return;
+        case BULK_WALK_NOT_AVAILABLE:
+            break;
+        }
+    }
+#endif
     if(prepare_to_walk_a_directory(directory_name, dirname_length, file_path_buffer, &pdir, tracker)) {
         return;
     }
     struct dirent *pent;
     while((pent = readdir(pdir)) != NULL) {
-        reset_base_path_termination(file_path_buffer, dirname_length);
-        if(strcmp(pent->d_name, ".") == 0 || strcmp(pent->d_name, "..") == 0) {
+#ifdef DT_UNKNOWN
+        int type = pent->d_type;
+#else
+        int type = 0;
+#endif
+        walk_named_directory_entry(dirfd(pdir), pent->d_name, type,
+                                   file_path_buffer, dirname_length, tracker);
+    }
+    closedir(pdir);
+}
+
+
+
+        //
+        // THE GIT INDEX WALKER
+        //
+
+static bool
+has_a_hidden_component(const char *path)
+{
+    return path[0] == '.' || strstr(path, "/.") != NULL;
+}
+
+// Unresolved merges list a path up to three times, once per stage : it's walked once.
+static bool
+is_walked_in_the_worktree(Git_index_entry *entry, char *previous_path)
+{
+    return (entry->mode & GIT_MODE_TYPE_MASK) == GIT_MODE_REGULAR_FILE &&
+           !entry->skip_worktree &&
+           (entry->stage == 0 || strcmp(entry->path, previous_path) != 0);
+}
+
+void
+walk_git_index(char *directory_name, bool only_changed, Walk_tracker *tracker)
+{
+    Git_index *index = open_git_index(directory_name);
+    if(index == NULL) {
+        fprintf(stdout, "%s : can not read the git index of %s\n", tracker->program_name, directory_name);
+        ++ tracker->read_errors_count;
+        return;
+    }
+    char file_path_buffer[WALKERS_MAX_PATH_LENGTH];
+    char previous_path[WALKERS_MAX_PATH_LENGTH] = "";
+    int dirname_length = strlen(directory_name);
+    bool in_current_directory = strcmp(directory_name, ".") == 0;
+    if(!in_current_directory) {
+        if(dirname_length+1 >= WALKERS_MAX_PATH_LENGTH) {
+            fprintf(stdout, "%s : pathname exceeding maximum length : %s\n",
+                    tracker->program_name, directory_name);
+            close_git_index(index);
+            return;
+        }
+        strcpy(file_path_buffer, directory_name);
+    }
+
+    Git_index_entry entry;
+    struct stat statinfo;
+    while(next_git_index_entry(index, &entry)) {
+        if(!is_walked_in_the_worktree(&entry, previous_path)) {
+            continue;
+        }
+        if(entry.path_length < WALKERS_MAX_PATH_LENGTH) {
+            strcpy(previous_path, entry.path);
+        }
+        char *path = file_path_buffer;
+        if(in_current_directory && entry.path_length < WALKERS_MAX_PATH_LENGTH) {
+            strcpy(file_path_buffer, entry.path);
+        } else if(in_current_directory) {
+            fprintf(stdout, "%s : pathname exceeding maximum length : %s\n",
+                    tracker->program_name, entry.path);
             continue;
+        } else {
+            reset_base_path_termination(file_path_buffer, dirname_length);
+            if(append_filename_to_base_path(file_path_buffer, dirname_length, (char *)entry.path, tracker)) {
+                continue;
+            }
         }
-        if(append_filename_to_base_path(file_path_buffer, dirname_length, pent->d_name, tracker)) {
+
+        if(has_a_hidden_component(entry.path) && tracker->skip_hidden) {
+            skip_a_hidden_file(path, tracker);
+        } else if(stat(path, &statinfo)) {
+            // deleted from the worktree, but not from the index yet
+            if(errno != ENOENT) {
+                found_an_unreadable_file(path, tracker);
+            } else if(tracker->verbose) {
+                fprintf(stdout, "%s : skipped deleted file : %s\n", tracker->program_name, path);
+            }
+        } else if(!S_ISREG(statinfo.st_mode)) {
             continue;
+        } else if(only_changed && git_index_entry_is_unchanged(index, &entry, &statinfo)) {
+            if(tracker->verbose) {
+                fprintf(stdout, "%s : skipped file unchanged for git : %s\n", tracker->program_name, path);
+            }
+        } else {
+            found_a_file_that_needs_processing(path, &statinfo, tracker);
         }
-        char *single_filename_array[1] = {file_path_buffer};
-        walk_filenames(single_filename_array, 1, tracker);
     }
-    closedir(pdir);
+    close_git_index(index);
+}
+
+
+
+        //
+        // THE PARALLEL WALK
+        //
+        // Each thread has a deque of directories to walk. A thread pushes the subdirectories
+        // it finds on its own deque, and pops them back from the same end (depth first).
+        // A thread whose deque is empty steals from the other end of the others' deques :
+        // those are the directories found earliest, that likely hold the most work.
+        //
+        // The walk is over when no directory is left queued nor being walked.
+        // Each thread counts what it does on its own copy of the tracker ; these counts are
+        // added to the caller's tracker in the end.
+        //
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    int pending;        // directories queued or being walked
+    int queued;         // directories queued
+    int thread_count;
+} Parallel_walk;
+
+typedef struct {
+    pthread_mutex_t lock;
+    char **directories; // the deque : directories[head] to directories[tail-1]
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} Directory_deque;
+
+struct Walker_thread {
+    Parallel_walk *walk;
+    struct Walker_thread *all_threads;
+    int index;
+    Directory_deque deque;
+    Walk_tracker tracker;
+    pthread_t thread;
+    bool started;
+};
+
+
+static void
+finish_task(Parallel_walk *walk)
+{
+    pthread_mutex_lock(&walk->lock);
+    if(--walk->pending == 0) {
+        pthread_cond_broadcast(&walk->work_available);
+    }
+    pthread_mutex_unlock(&walk->lock);
+}
+
+
+// Directories that can't be queued are walked right away.
+static void
+queue_directory(char *directory_name, Walk_tracker *tracker)
+{
+    struct Walker_thread *self = tracker->walker_thread;
+    Directory_deque *deque = &(self->deque);
+    char *queued_name = strdup(directory_name);
+    if(queued_name == NULL) {
+        walk_directory(directory_name, tracker);
+        return;
+    }
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail == deque->capacity) {
+        size_t new_capacity = deque->capacity ? 2*deque->capacity : 64;
+        char **grown = realloc(deque->directories, new_capacity * sizeof(char*));
+        if(grown == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            free(queued_name);
+            walk_directory(directory_name, tracker);
+            return;
+        }
+        deque->directories = grown;
+        deque->capacity = new_capacity;
+    }
+    // Counted before it can be stolen, so that pending can't drop to 0 in the meantime.
+    Parallel_walk *walk = self->walk;
+    pthread_mutex_lock(&walk->lock);
+    ++ walk->pending;
+    ++ walk->queued;
+    pthread_cond_signal(&walk->work_available);
+    pthread_mutex_unlock(&walk->lock);
+    deque->directories[deque->tail ++] = queued_name;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+
+// Returns NULL if the deque is empty.
+static char *
+take_from_deque(Directory_deque *deque, bool from_tail)
+{
+    char *directory_name = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->head < deque->tail) {
+        directory_name = from_tail ? deque->directories[-- deque->tail]
+                                   : deque->directories[deque->head ++];
+        if(deque->head == deque->tail) {
+            deque->head = deque->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return directory_name;
+}
+
+// Returns NULL if there's no directory left in any deque.
+static char *
+take_directory(struct Walker_thread *self)
+{
+    Parallel_walk *walk = self->walk;
+    char *directory_name = take_from_deque(&(self->deque), true);
+    for(int i=1; directory_name == NULL && i<walk->thread_count; ++i) {
+        struct Walker_thread *victim = &(self->all_threads[(self->index + i) % walk->thread_count]);
+        directory_name = take_from_deque(&(victim->deque), false);
+    }
+    if(directory_name != NULL) {
+        pthread_mutex_lock(&walk->lock);
+        -- walk->queued;
+        pthread_mutex_unlock(&walk->lock);
+    }
+    return directory_name;
+}
+
+
+static void *
+run_walker_thread(void *p_self)
+{
+    struct Walker_thread *self = (struct Walker_thread *)p_self;
+    Parallel_walk *walk = self->walk;
+    for(;;) {
+        char *directory_name = take_directory(self);
+        if(directory_name != NULL) {
+            walk_directory(directory_name, &(self->tracker));
+            free(directory_name);
+            finish_task(walk);
+            continue;
+        }
+        pthread_mutex_lock(&walk->lock);
+        while(walk->pending > 0 && walk->queued == 0) {
+            pthread_cond_wait(&walk->work_available, &walk->lock);
+        }
+        bool done = (walk->pending == 0);
+        pthread_mutex_unlock(&walk->lock);
+        if(done) {
+            return NULL;
+        }
+    }
+}
+
+
+static void
+add_tracker_counters(Walk_tracker *sum, Walk_tracker *t)
+{
+    sum->processed_count += t->processed_count;
+    sum->skipped_directories_count += t->skipped_directories_count;
+    sum->skipped_hidden_files_count += t->skipped_hidden_files_count;
+    sum->read_errors_count += t->read_errors_count;
+}
+
+
+// The calling thread is the walk's thread 0 : it walks the file names themselves, queuing
+// the directories among them, while the other threads start stealing these directories.
+// The file names count as one pending task, so that no thread quits before they're done.
+static void
+walk_in_parallel(char **filenames, int file_count, Walk_tracker *tracker)
+{
+    Parallel_walk walk = {.pending=1, .queued=0, .thread_count=tracker->threads};
+    struct Walker_thread *threads = calloc(walk.thread_count, sizeof(struct Walker_thread));
+    if(threads == NULL) {
+        Walk_tracker serial_tracker = *tracker;
+        serial_tracker.threads = 1;
+        walk_filenames(filenames, file_count, &serial_tracker);
+        add_tracker_counters(tracker, &serial_tracker);
+        return;
+    }
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.work_available, NULL);
+
+    for(int i=0; i<walk.thread_count; ++i) {
+        struct Walker_thread *t = &(threads[i]);
+        t->walk = &walk;
+        t->all_threads = threads;
+        t->index = i;
+        pthread_mutex_init(&(t->deque.lock), NULL);
+        t->tracker = *tracker;
+        t->tracker.processed_count = 0;
+        t->tracker.skipped_directories_count = 0;
+        t->tracker.skipped_hidden_files_count = 0;
+        t->tracker.read_errors_count = 0;
+        t->tracker.walker_thread = t;
+    }
+    // If a thread can't be started, the others steal its share : its deque stays empty.
+    for(int i=1; i<walk.thread_count; ++i) {
+        threads[i].started = !pthread_create(&(threads[i].thread), NULL, run_walker_thread, &(threads[i]));
+    }
+
+    walk_filenames(filenames, file_count, &(threads[0].tracker));
+    finish_task(&walk);
+    run_walker_thread(&(threads[0]));
+
+    for(int i=0; i<walk.thread_count; ++i) {
+        if(threads[i].started) {
+            pthread_join(threads[i].thread, NULL);
+        }
+    }
+    for(int i=0; i<walk.thread_count; ++i) {
+        add_tracker_counters(tracker, &(threads[i].tracker));
+        pthread_mutex_destroy(&(threads[i].deque.lock));
+        free(threads[i].deque.directories);
+    }
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.work_available);
+    free(threads);
 }
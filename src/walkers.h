@@ -24,11 +24,13 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/stat.h>
 
 //
-// The walkers : walk_filenames and walk_directory.
-// They walk a sequence of items (file names or the content of a directory) and run a callback on regular file items.
+// The walkers : walk_filenames, walk_filename_list, walk_directory and walk_git_index.
+// They walk a sequence of items (file names, the content of a directory, or the files git tracks)
+// and run a callback on regular file items.
 // Symbolic links get plainly ignored as of now.
 //
 
@@ -49,8 +51,17 @@
 // - recurse : call walk_directory automatically when a subdirectory is found.
 // - skip_hidden : skip files whose name starts with a dot.
 // - verbose : self explanatory.
+// - threads : when recursing, walk that many directories at a time, each thread taking
+//             subdirectories from its own queue, or stealing them from the others' when
+//             it runs out. process_file must then be safe to call from several threads at once.
+//             Directories are then walked in no particular order.
+// - enter_directory : if not NULL, called by walk_directory with the name of each directory it
+//                     walks, and enter_directory_context, before the directory is read.
+//                     With threads, it must be safe to call from several threads at once.
 //
 
+struct Walker_thread;
+
 typedef struct {
     char *program_name;
 
@@ -60,12 +71,18 @@ typedef struct {
     bool verbose;
     bool recurse;
     bool skip_hidden;
+    int threads;
+    void (*enter_directory)(char*, void*);
+    void *enter_directory_context;
 
     // counters updated by the walkers as they go
     int processed_count;
     int skipped_directories_count;
     int skipped_hidden_files_count;
     int read_errors_count;
+
+    // set by the walkers on the trackers of their threads ; NULL otherwise
+    struct Walker_thread *walker_thread;
 } Walk_tracker;
 
 
@@ -81,10 +98,14 @@ make_default_walk_tracker();
         .verbose = false,\
         .recurse = false,\
         .skip_hidden = true,\
+        .threads = 1,\
+        .enter_directory = NULL,\
+        .enter_directory_context = NULL,\
         .processed_count = 0,\
         .skipped_directories_count = 0,\
         .skipped_hidden_files_count = 0,\
-        .read_errors_count = 0
+        .read_errors_count = 0,\
+        .walker_thread = NULL
 
 
 // THE WALKERS
@@ -92,8 +113,21 @@ make_default_walk_tracker();
 void
 walk_filenames(char **filenames, int file_count, Walk_tracker *tracker);
 
+// Walks the file names read from list, as walk_filenames does, a batch at a time :
+// however long the list, only a batch of names is held at once.
+// Names are separated by NULs (as find -print0 writes them) or by newlines, whichever ends
+// the first name. Empty names are ignored, and so is a CR ending a name in a newline separated list.
+void
+walk_filename_list(FILE *list, Walk_tracker *tracker);
+
 void
 walk_directory(char *directory_name, Walk_tracker *tracker);
 
+// Walks the regular files that git tracks in the working tree found in directory_name,
+// as listed by its index (see git_index.h), whatever recurse is set to.
+// With only_changed, files whose size and modification time still match the index are skipped.
+void
+walk_git_index(char *directory_name, bool only_changed, Walk_tracker *tracker);
+
 
 #endif
@@ -0,0 +1,565 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pthreads, strdup, clock_gettime and st_mtim
+#define _POSIX_C_SOURCE 200809L
+
+#include "watcher.h"
+#include "endlines.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+
+// SEE watcher.h FOR INTERFACE DOCUMENTATION
+
+
+#ifdef __linux__
+
+// Files are created with IN_CREATE, but only worth looking at once written and closed.
+#define WATCHED_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+
+#define EVENTS_BUFFER_SIZE (64*1024)
+
+
+//
+// A set of file names, that remembers the order they came in.
+//
+
+typedef struct {
+    char **filenames;        // in the order they came in
+    size_t count;
+    size_t capacity;
+    size_t *slots;           // hash table : index in filenames + 1, or 0 for a free slot
+    size_t slots_count;      // a power of 2, kept more than twice count
+} File_set;
+
+
+static uint64_t
+hash_filename(const char *filename)
+{
+    uint64_t h = 14695981039346656037ULL;    // FNV-1a
+    for(; *filename; ++filename) {
+        h = (h ^ (unsigned char)*filename) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Returns the slot that holds filename, or the free slot where it would go.
+static size_t
+find_slot(File_set *set, const char *filename)
+{
+    size_t mask = set->slots_count - 1;
+    size_t slot = (size_t)hash_filename(filename) & mask;
+    while(set->slots[slot] && strcmp(set->filenames[set->slots[slot] - 1], filename)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Returns the index of filename in the set, or -1.
+static long
+index_in_set(File_set *set, const char *filename)
+{
+    if(set->count == 0) {
+        return -1;
+    }
+    size_t slot = find_slot(set, filename);
+    return set->slots[slot] ? (long)(set->slots[slot] - 1) : -1;
+}
+
+static bool
+grow_set(File_set *set)
+{
+    size_t capacity = set->capacity ? 2 * set->capacity : 64;
+    char **filenames = realloc(set->filenames, capacity * sizeof(char*));
+    if(filenames == NULL) {
+        return false;
+    }
+    set->filenames = filenames;
+    size_t *slots = calloc(2 * capacity, sizeof(size_t));
+    if(slots == NULL) {
+        return false;
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->slots_count = 2 * capacity;
+    set->capacity = capacity;
+    for(size_t i=0; i<set->count; ++i) {
+        set->slots[find_slot(set, set->filenames[i])] = i + 1;
+    }
+    return true;
+}
+
+// Takes filename over. Returns false if there's no memory left for it.
+static bool
+add_to_set(File_set *set, char *filename)
+{
+    if(index_in_set(set, filename) >= 0) {
+        free(filename);
+        return true;
+    }
+    if(set->count == set->capacity && !grow_set(set)) {
+        free(filename);
+        return false;
+    }
+    set->filenames[set->count] = filename;
+    set->slots[find_slot(set, filename)] = ++ set->count;
+    return true;
+}
+
+static void
+clear_set(File_set *set)
+{
+    for(size_t i=0; i<set->count; ++i) {
+        free(set->filenames[i]);
+    }
+    if(set->slots != NULL) {
+        memset(set->slots, 0, set->slots_count * sizeof(size_t));
+    }
+    set->count = 0;
+}
+
+static void
+free_set(File_set *set)
+{
+    clear_set(set);
+    free(set->filenames);
+    free(set->slots);
+}
+
+
+
+//
+// The watcher
+//
+
+typedef struct {
+    bool known;
+    struct stat statinfo;
+} Settled_file;
+
+struct Watcher {
+    int fd;
+    char **roots;
+    int root_count;
+
+    pthread_mutex_t lock;        // guards the directories and processed files :
+                                 // walker and worker threads come to them concurrently
+    char **directories;          // by watch descriptor ; NULL for those not in use
+    int directories_capacity;
+    int watched_count;
+
+    File_set changed;            // not reported yet
+    long long first_change_ms;
+    long long last_change_ms;
+
+    File_set reported;           // being processed
+    char **reported_list;        // those of them that still exist
+
+    File_set processed;          // written to by processing, guarded by lock
+    pthread_mutex_t catching_up; // guards the rest, and changed : one thread catches up at a time
+    File_set settling;           // the processed files whose changes are being left out
+    Settled_file *settled;       // what processing left them like, by index in settling
+};
+
+
+static long long
+now_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static bool
+is_same_file_version(struct stat *a, struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtime == b->st_mtime && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+
+Watcher *
+new_watcher(char **roots, int root_count)
+{
+    Watcher *watcher = calloc(1, sizeof(Watcher));
+    if(watcher == NULL) {
+        return NULL;
+    }
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(watcher->fd < 0) {
+        free(watcher);
+        return NULL;
+    }
+    watcher->roots = roots;
+    watcher->root_count = root_count;
+    pthread_mutex_init(&watcher->lock, NULL);
+    pthread_mutex_init(&watcher->catching_up, NULL);
+    return watcher;
+}
+
+
+void
+destroy_watcher(Watcher *watcher)
+{
+    if(watcher == NULL) {
+        return;
+    }
+    close(watcher->fd);
+    for(int i=0; i<watcher->directories_capacity; ++i) {
+        free(watcher->directories[i]);
+    }
+    free(watcher->directories);
+    free_set(&watcher->changed);
+    free_set(&watcher->reported);
+    free_set(&watcher->processed);
+    free_set(&watcher->settling);
+    free(watcher->reported_list);
+    free(watcher->settled);
+    pthread_mutex_destroy(&watcher->lock);
+    pthread_mutex_destroy(&watcher->catching_up);
+    free(watcher);
+}
+
+
+// A directory watched again, e.g. after being moved, keeps its watch descriptor : it's renamed.
+void
+watch_directory(char *directory_name, void *p_watcher)
+{
+    Watcher *watcher = (Watcher *)p_watcher;
+    int wd = inotify_add_watch(watcher->fd, directory_name, WATCHED_EVENTS);
+    if(wd < 0) {
+        fprintf(stdout, "%s : can not watch %s%s\n", PROGRAM_NAME, directory_name,
+                errno == ENOSPC ? " -- too many directories watched (see fs.inotify.max_user_watches)" : "");
+        return;
+    }
+    char *name = strdup(directory_name);
+    pthread_mutex_lock(&watcher->lock);
+    if(wd >= watcher->directories_capacity) {
+        int capacity = watcher->directories_capacity ? watcher->directories_capacity : 256;
+        while(capacity <= wd) {
+            capacity *= 2;
+        }
+        char **directories = realloc(watcher->directories, capacity * sizeof(char*));
+        if(directories != NULL) {
+            memset(directories + watcher->directories_capacity, 0,
+                   (capacity - watcher->directories_capacity) * sizeof(char*));
+            watcher->directories = directories;
+            watcher->directories_capacity = capacity;
+        }
+    }
+    if(name != NULL && wd < watcher->directories_capacity) {
+        if(watcher->directories[wd] == NULL) {
+            ++ watcher->watched_count;
+        }
+        free(watcher->directories[wd]);
+        watcher->directories[wd] = name;
+        name = NULL;
+    }
+    pthread_mutex_unlock(&watcher->lock);
+    if(name == NULL) {
+        return;
+    }
+    free(name);
+    inotify_rm_watch(watcher->fd, wd);
+    fprintf(stdout, "%s : can not watch %s -- can't allocate memory\n", PROGRAM_NAME, directory_name);
+}
+
+
+int
+watched_directories_count(Watcher *watcher)
+{
+    pthread_mutex_lock(&watcher->lock);
+    int count = watcher->watched_count;
+    pthread_mutex_unlock(&watcher->lock);
+    return count;
+}
+
+
+static void
+forget_directory(Watcher *watcher, int wd)
+{
+    pthread_mutex_lock(&watcher->lock);
+    if(wd >= 0 && wd < watcher->directories_capacity && watcher->directories[wd] != NULL) {
+        free(watcher->directories[wd]);
+        watcher->directories[wd] = NULL;
+        -- watcher->watched_count;
+    }
+    pthread_mutex_unlock(&watcher->lock);
+}
+
+// Returns the path of the file the event is about, to be freed, or NULL.
+static char *
+path_of_event_file(Watcher *watcher, struct inotify_event *event)
+{
+    char *path = NULL;
+    pthread_mutex_lock(&watcher->lock);
+    if(event->wd >= 0 && event->wd < watcher->directories_capacity &&
+       watcher->directories[event->wd] != NULL) {
+        char *directory = watcher->directories[event->wd];
+        size_t length = strlen(directory);
+        path = malloc(length + strlen(event->name) + 2);
+        if(path != NULL) {
+            sprintf(path, (length > 0 && directory[length-1] == '/') ? "%s%s" : "%s/%s",
+                    directory, event->name);
+        }
+    }
+    pthread_mutex_unlock(&watcher->lock);
+    return path;
+}
+
+// Processing a file changes it again : those changes are recognized, and ignored,
+// as long as the file is as processing left it.
+static bool
+was_changed_by_processing(Watcher *watcher, char *path)
+{
+    long i = index_in_set(&watcher->settling, path);
+    struct stat statinfo;
+    return i >= 0 && watcher->settled != NULL && watcher->settled[i].known &&
+           !stat(path, &statinfo) && is_same_file_version(&statinfo, &(watcher->settled[i].statinfo));
+}
+
+static void
+note_change(Watcher *watcher, char *path)
+{
+    long long now = now_ms();
+    if(watcher->changed.count == 0) {
+        watcher->first_change_ms = now;
+    }
+    watcher->last_change_ms = now;
+    if(!add_to_set(&watcher->changed, path)) {
+        fprintf(stdout, "%s : can't allocate memory -- missed a change\n", PROGRAM_NAME);
+    }
+}
+
+static void
+handle_event(Watcher *watcher, struct inotify_event *event)
+{
+    if(event->mask & IN_Q_OVERFLOW) {
+        fprintf(stdout, "%s : too many changes at once, some went unnoticed -- walking everything again\n",
+                PROGRAM_NAME);
+        for(int i=0; i<watcher->root_count; ++i) {
+            char *root = strdup(watcher->roots[i]);
+            if(root != NULL) {
+                note_change(watcher, root);
+            }
+        }
+        return;
+    }
+    if(event->mask & IN_IGNORED) {
+        forget_directory(watcher, event->wd);
+        return;
+    }
+    bool is_directory = event->mask & IN_ISDIR;
+    bool is_of_interest = is_directory ? (event->mask & (IN_CREATE | IN_MOVED_TO))
+                                       : (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO));
+    if(event->len == 0 || !is_of_interest ||
+       !strncmp(event->name, TMP_FILENAME_BASE, strlen(TMP_FILENAME_BASE))) {
+        return;
+    }
+    char *path = path_of_event_file(watcher, event);
+    if(path == NULL) {
+        return;
+    }
+    if(!is_directory && was_changed_by_processing(watcher, path)) {
+        free(path);
+        return;
+    }
+    note_change(watcher, path);
+}
+
+// Returns false if reading failed.
+static bool
+read_events(Watcher *watcher)
+{
+    union {
+        struct inotify_event event;         // for the alignment
+        char bytes[EVENTS_BUFFER_SIZE];
+    } buffer;
+    ssize_t got;
+    while((got = read(watcher->fd, buffer.bytes, sizeof(buffer.bytes))) > 0) {
+        for(ssize_t offset = 0; offset < got; ) {
+            struct inotify_event *event = (struct inotify_event *)(buffer.bytes + offset);
+            handle_event(watcher, event);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return got == 0 || errno == EAGAIN || errno == EINTR;
+}
+
+
+int
+wait_for_changed_files(Watcher *watcher, char ***filenames)
+{
+    for(;;) {
+        int timeout = -1;
+        if(watcher->changed.count > 0) {
+            long long due = watcher->last_change_ms + WATCH_SETTLING_DELAY_MS;
+            if(due > watcher->first_change_ms + WATCH_MAX_DELAY_MS) {
+                due = watcher->first_change_ms + WATCH_MAX_DELAY_MS;
+            }
+            long long now = now_ms();
+            if(now >= due) {
+                break;
+            }
+            timeout = (int)(due - now);
+        }
+        struct pollfd p = {.fd = watcher->fd, .events = POLLIN};
+        int ready = poll(&p, 1, timeout);
+        if((ready < 0 && errno != EINTR) || (ready > 0 && !read_events(watcher))) {
+            return -1;
+        }
+    }
+
+    File_set reported = watcher->reported;
+    watcher->reported = watcher->changed;
+    watcher->changed = reported;
+    free(watcher->reported_list);
+    watcher->reported_list = malloc(watcher->reported.count * sizeof(char*));
+    if(watcher->reported_list == NULL) {
+        return -1;
+    }
+    // Files often go as soon as they came : editors' backups, downloads in progress...
+    int count = 0;
+    struct stat statinfo;
+    for(size_t i=0; i<watcher->reported.count; ++i) {
+        char *filename = watcher->reported.filenames[i];
+        if(!lstat(filename, &statinfo) || errno != ENOENT) {
+            watcher->reported_list[count++] = filename;
+        }
+    }
+    *filenames = watcher->reported_list;
+    return count;
+}
+
+
+void
+note_processed_file(Watcher *watcher, char *filename)
+{
+    char *copy = strdup(filename);
+    if(copy == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&watcher->lock);
+    add_to_set(&watcher->processed, copy);
+    pthread_mutex_unlock(&watcher->lock);
+}
+
+
+// With several worker threads, changes may have been taken in while processing a file was
+// under way on another thread, before it got noted : they're left out now, as long as the
+// file is still as processing left it.
+static void
+forget_changes_made_by_processing(Watcher *watcher)
+{
+    if(watcher->settling.count == 0 || watcher->changed.count == 0) {
+        return;
+    }
+    File_set changed = watcher->changed;
+    memset(&watcher->changed, 0, sizeof(File_set));
+    for(size_t i=0; i<changed.count; ++i) {
+        char *filename = changed.filenames[i];
+        if(was_changed_by_processing(watcher, filename)) {
+            free(filename);
+        } else if(!add_to_set(&watcher->changed, filename)) {
+            fprintf(stdout, "%s : can't allocate memory -- missed a change\n", PROGRAM_NAME);
+        }
+    }
+    free(changed.filenames);
+    free(changed.slots);
+}
+
+// The files noted so far are set aside, and what processing left them like is looked up,
+// before the events that processing raised are read. Files noted in the meantime are left
+// for the next time. Expects catching_up to be held.
+static void
+take_in_changes(Watcher *watcher)
+{
+    pthread_mutex_lock(&watcher->lock);
+    File_set settling = watcher->settling;    // empty
+    watcher->settling = watcher->processed;
+    watcher->processed = settling;
+    pthread_mutex_unlock(&watcher->lock);
+
+    watcher->settled = malloc(watcher->settling.count * sizeof(Settled_file));
+    if(watcher->settled != NULL) {
+        for(size_t i=0; i<watcher->settling.count; ++i) {
+            watcher->settled[i].known = !stat(watcher->settling.filenames[i], &(watcher->settled[i].statinfo));
+        }
+    }
+    read_events(watcher);
+    forget_changes_made_by_processing(watcher);
+    free(watcher->settled);
+    watcher->settled = NULL;
+    clear_set(&watcher->settling);
+}
+
+
+void
+catch_up_with_changes(Watcher *watcher)
+{
+    if(pthread_mutex_trylock(&watcher->catching_up)) {
+        return;
+    }
+    take_in_changes(watcher);
+    pthread_mutex_unlock(&watcher->catching_up);
+}
+
+
+void
+done_with_changed_files(Watcher *watcher)
+{
+    pthread_mutex_lock(&watcher->catching_up);
+    // The events that processing raised have all been queued by now.
+    take_in_changes(watcher);
+    pthread_mutex_unlock(&watcher->catching_up);
+    free(watcher->reported_list);
+    watcher->reported_list = NULL;
+    clear_set(&watcher->reported);
+}
+
+
+#else
+
+Watcher *
+new_watcher(char **roots, int root_count)
+{
+    return NULL;
+}
+
+void destroy_watcher(Watcher *watcher) {}
+void watch_directory(char *directory_name, void *watcher) {}
+int watched_directories_count(Watcher *watcher) { return 0; }
+void note_processed_file(Watcher *watcher, char *filename) {}
+void catch_up_with_changes(Watcher *watcher) {}
+int wait_for_changed_files(Watcher *watcher, char ***filenames) { return -1; }
+void done_with_changed_files(Watcher *watcher) {}
+
+#endif
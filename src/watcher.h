@@ -0,0 +1,84 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _WATCHER_H_
+#define _WATCHER_H_
+
+#include <stdbool.h>
+
+//
+// The watcher : tells which files were written to, in a set of watched directories.
+//
+// Directories get watched as they're walked : watch_directory takes the place of a walker's
+// enter_directory callback, with the watcher as context (see walkers.h). Directories that the
+// walk skips, such as hidden ones, aren't watched.
+//
+// Files that were closed after being written to, or renamed into a watched directory, are
+// reported once things have settled : once no file has changed for WATCH_SETTLING_DELAY_MS,
+// or at the latest WATCH_MAX_DELAY_MS after the first change. New directories are reported
+// along with them : walking them gets them watched too.
+// endlines' own temporary files (see TMP_FILENAME_BASE) are never reported.
+//
+// Based on inotify, on Linux. Elsewhere, new_watcher returns NULL.
+//
+
+#define WATCH_SETTLING_DELAY_MS 300
+#define WATCH_MAX_DELAY_MS 3000
+
+
+typedef struct Watcher Watcher;
+
+
+// roots are the files and directories to walk again if the kernel drops events
+// (when too many come at once) : they must outlive the watcher.
+// Returns NULL if the system can't watch for changes.
+Watcher *new_watcher(char **roots, int root_count);
+
+void destroy_watcher(Watcher *watcher);
+
+// Watches the directory. Its signature matches the walkers' enter_directory callback.
+// Safe to call from several threads at once.
+void watch_directory(char *directory_name, void *watcher);
+
+int watched_directories_count(Watcher *watcher);
+
+// Blocks until files have changed, and things have settled (see above).
+// Points filenames to the names of the files and directories that changed, and returns
+// how many there are. They are valid until done_with_changed_files is called.
+// Returns -1 if the watcher failed.
+int wait_for_changed_files(Watcher *watcher, char ***filenames);
+
+// Tells that processing wrote to the file : the changes that it made are to be ignored.
+// Safe to call from several threads at once.
+void note_processed_file(Watcher *watcher, char *filename);
+
+// Takes in the changes that have come so far, leaving out those that processing made to the
+// files noted since the last call, so that they don't pile up in the kernel until it drops
+// some : to be called every WATCH_CATCH_UP_INTERVAL processed files or so, while processing.
+// Safe to call from several threads at once : a call made while another one is under way
+// returns right away.
+#define WATCH_CATCH_UP_INTERVAL 128
+void catch_up_with_changes(Watcher *watcher);
+
+// To be called once the changed files have been processed (and once the first walk is over) :
+// forgets about them, and about the changes processing made to the files noted since the
+// last call, as long as they are still as processing left them.
+void done_with_changed_files(Watcher *watcher);
+
+
+#endif
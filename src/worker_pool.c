@@ -0,0 +1,175 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// for pthreads
+#define _POSIX_C_SOURCE 200809L
+
+#include "worker_pool.h"
+#include "walkers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// SEE worker_pool.h FOR INTERFACE DOCUMENTATION
+
+
+// Queued files per thread : enough to keep threads busy while the walker reads directories.
+#define QUEUED_FILES_PER_THREAD 16
+
+typedef struct {
+    char filename[WALKERS_MAX_PATH_LENGTH];
+    struct stat statinfo;
+} Queued_item;
+
+typedef struct {
+    Worker_pool *pool;
+    void *context;
+    pthread_t thread;
+} Worker;
+
+struct Worker_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    Queued_item *queue;      // a ring of capacity items
+    int capacity;
+    int head;
+    int count;
+    bool closed;             // no more files will be submitted
+
+    void (*process_file)(char*, struct stat*, void*);
+    void (*finish_worker)(void*);
+    Worker *workers;
+    int thread_count;
+};
+
+
+static void *
+run_worker(void *p_worker)
+{
+    Worker *worker = (Worker *)p_worker;
+    Worker_pool *pool = worker->pool;
+    Queued_item item;
+
+    for(;;) {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->count == 0 && !pool->closed) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        if(pool->count == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        memcpy(&item, &(pool->queue[pool->head]), sizeof(Queued_item));
+        pool->head = (pool->head + 1) % pool->capacity;
+        -- pool->count;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->process_file(item.filename, &item.statinfo, worker->context);
+    }
+    if(pool->finish_worker) {
+        pool->finish_worker(worker->context);
+    }
+    return NULL;
+}
+
+
+Worker_pool *
+new_worker_pool(int thread_count,
+                void (*process_file)(char*, struct stat*, void*),
+                void (*finish_worker)(void*),
+                void **worker_contexts)
+{
+    if(thread_count > MAX_WORKER_THREADS) {
+        thread_count = MAX_WORKER_THREADS;
+    }
+    Worker_pool *pool = calloc(1, sizeof(Worker_pool));
+    if(pool == NULL) {
+        return NULL;
+    }
+    pool->capacity = thread_count * QUEUED_FILES_PER_THREAD;
+    pool->queue = malloc(pool->capacity * sizeof(Queued_item));
+    pool->workers = calloc(thread_count, sizeof(Worker));
+    if(pool->queue == NULL || pool->workers == NULL) {
+        free(pool->queue);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pool->process_file = process_file;
+    pool->finish_worker = finish_worker;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+
+    for(int i=0; i<thread_count; ++i) {
+        Worker *worker = &(pool->workers[i]);
+        worker->pool = pool;
+        worker->context = worker_contexts[i];
+        if(pthread_create(&worker->thread, NULL, run_worker, worker)) {
+            break;
+        }
+        ++ pool->thread_count;
+    }
+    if(pool->thread_count == 0) {
+        finish_worker_pool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+
+void
+submit_to_worker_pool(char *filename, struct stat *statinfo, void *p_pool)
+{
+    Worker_pool *pool = (Worker_pool *)p_pool;
+    pthread_mutex_lock(&pool->lock);
+    while(pool->count == pool->capacity) {
+        pthread_cond_wait(&pool->not_full, &pool->lock);
+    }
+    Queued_item *item = &(pool->queue[(pool->head + pool->count) % pool->capacity]);
+    strncpy(item->filename, filename, WALKERS_MAX_PATH_LENGTH - 1);
+    item->filename[WALKERS_MAX_PATH_LENGTH - 1] = 0;
+    item->statinfo = *statinfo;
+    ++ pool->count;
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void
+finish_worker_pool(Worker_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i=0; i<pool->thread_count; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_cond_destroy(&pool->not_full);
+    free(pool->queue);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,57 @@
+/*
+   This file is part of endlines' source code
+
+   Copyright 2014-2019 Mathias Dolidon
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+//
+// The worker pool : a bounded queue of files, consumed by a set of threads.
+//
+// It takes the place of a walker's process_file callback : the walker submits files
+// with submit_to_worker_pool, and each worker thread runs process_file on them, with
+// its own context object (for instance, its own accumulator), as the third argument.
+// Files may be submitted from several threads at once (those of a parallel walk).
+//
+
+// Largest number of threads in a pool.
+#define MAX_WORKER_THREADS 256
+
+
+typedef struct Worker_pool Worker_pool;
+
+
+// Starts thread_count threads. worker_contexts holds one context object per thread.
+// finish_worker, if not NULL, is run by each worker thread once there are no more files.
+// Returns NULL if no thread could be started : the caller should then process files itself.
+Worker_pool *new_worker_pool(int thread_count,
+                             void (*process_file)(char*, struct stat*, void*),
+                             void (*finish_worker)(void*),
+                             void **worker_contexts);
+
+// Copies the file name and stat info into the queue, waiting for room if it is full.
+// Its signature matches the walkers' process_file callback, with the pool as accumulator.
+void submit_to_worker_pool(char *filename, struct stat *statinfo, void *pool);
+
+// Waits until all submitted files have been processed and all threads are done, then frees the pool.
+void finish_worker_pool(Worker_pool *pool);
+
+
+#endif
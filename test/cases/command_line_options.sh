@@ -33,6 +33,37 @@ else
     ./case_failed.sh
 fi
 
+( printf 'SQLite format 3\000\r\n' ; cat data/winref ) >sandbox/signaturetest
+$ENDLINES unix -v sandbox/signaturetest >sandbox/sigbintest
+SIGBINARY=`cat sandbox/sigbintest`
+if [[ $SIGBINARY == *skipped* ]]
+then
+    echo "OK : skips binaries from the signature their contents start with"
+else
+    echo "FAILURE : didn't mention skipping a file that starts with a binary signature"
+    ./case_failed.sh
+fi
+
+# Text files may well start like some binary signatures do, as long as they hold no control character.
+SIGTEXT_OK=true
+for SIGNATURE in 'PAR1 := foo' 'GIF89a' '%%PDF-1.4' 'OggS' '!<arch>'
+do
+    ( printf "$SIGNATURE\r\n" ; cat data/winref ) >sandbox/sigtexttest
+    ( printf "$SIGNATURE\n" ; cat data/unixref ) >sandbox/sigtextref
+    $ENDLINES unix -q sandbox/sigtexttest
+    if [[ `$MD5<sandbox/sigtexttest` != `$MD5<sandbox/sigtextref` ]]
+    then
+        SIGTEXT_OK=false
+    fi
+done
+if [[ $SIGTEXT_OK == true ]]
+then
+    echo "OK : converts text files that start like a binary signature"
+else
+    echo "FAILURE : skipped a text file that only starts like a binary signature"
+    ./case_failed.sh
+fi
+
 cp data/abin sandbox/bbintest
 $ENDLINES unix -v -b sandbox/bbintest >sandbox/binforcetest
 BINARYFORCE=`cat sandbox/binforcetest`
@@ -55,6 +86,29 @@ else
     ./case_failed.sh
 fi
 
+cp data/winref sandbox/ext_in_upper_case_test.Exe
+$ENDLINES unix -v sandbox/ext_in_upper_case_test.Exe >sandbox/extcasetest
+EXTCASE=`cat sandbox/extcasetest`
+if [[ $EXTCASE == *skipped* ]]
+then
+    echo "OK : known binary extensions are matched whatever their case"
+else
+    echo "FAILURE : didn't skip a file with a known binary extension in mixed case"
+    ./case_failed.sh
+fi
+
+cp data/winref sandbox/extra_extension_test.blob
+printf '# extra binary extensions\n.BLOB\n\nbin2\n' >sandbox/extra_extensions
+$ENDLINES unix -v --binary-extensions=sandbox/extra_extensions sandbox/extra_extension_test.blob >sandbox/extraexttest
+EXTRAEXT=`cat sandbox/extraexttest`
+if [[ $EXTRAEXT == *skipped* ]]
+then
+    echo "OK : option --binary-extensions adds known binary extensions"
+else
+    echo "FAILURE : didn't skip a file with an extension added with --binary-extensions"
+    ./case_failed.sh
+fi
+
 cp data/bin_as_per_extension.exe sandbox/bin_as_per_extension_forced_test.exe
 $ENDLINES unix -v -b sandbox/bbintest >sandbox/extbinforcetest
 EXTBINARYFORCE=`cat sandbox/extbinforcetest`
@@ -133,3 +187,55 @@ else
 	echo "FAILURE : --final failed to add final to a file already in dest. convention"
 	./case_failed.sh
 fi
+
+cp data/winref sandbox/inplace
+ln sandbox/inplace sandbox/inplace_link
+UNIXREF=`$MD5<data/unixref`
+$ENDLINES unix -i sandbox/inplace >/dev/null
+INPLACE_OUT=`$MD5<sandbox/inplace_link`
+if [[ $INPLACE_OUT == $UNIXREF ]]
+then
+	echo "OK : option -i converts in place, keeping hard links"
+else
+	echo "FAILURE : an in-place conversion did not yield the expected output through a hard link"
+	./case_failed.sh
+fi
+
+cp data/unix_no_final sandbox/unix_final_appended
+ln sandbox/unix_final_appended sandbox/unix_final_appended_link
+$ENDLINES unix -f sandbox/unix_final_appended >/dev/null
+FINALAPPENDOUT=`$MD5<sandbox/unix_final_appended_link`
+if [[ $FINALADDEDREF == $FINALAPPENDOUT ]]
+then
+	echo "OK : a missing final was appended to the file itself, keeping hard links"
+else
+	echo "FAILURE : --final did not append the missing final to the file itself"
+	./case_failed.sh
+fi
+
+cp data/winref sandbox/buffersize
+$ENDLINES unix --buffer-size=64K sandbox/buffersize >/dev/null
+BUFFERSIZE_OUT=`$MD5<sandbox/buffersize`
+$ENDLINES unix --buffer-size=12 sandbox/buffersize >/dev/null 2>sandbox/buffersizetest
+BUFFERSIZE_ERR=`cat sandbox/buffersizetest`
+if [[ $BUFFERSIZE_OUT == $UNIXREF && $BUFFERSIZE_ERR == *"--buffer-size expects"* ]]
+then
+	echo "OK : option --buffer-size sets the buffer size, and rejects unreasonable ones"
+else
+	echo "FAILURE : option --buffer-size did not yield the expected output, or accepted a bad size"
+	./case_failed.sh
+fi
+
+cp data/winref sandbox/cached
+touch -t 201901010000 sandbox/cached
+$ENDLINES check --cache=sandbox/scancache sandbox/cached >sandbox/cachedfirst 2>&1
+$ENDLINES check --cache=sandbox/scancache sandbox/cached >sandbox/cachedsecond 2>&1
+echo "not a cache" >sandbox/notacache
+$ENDLINES check --cache=sandbox/notacache sandbox/cached >sandbox/cachedrefused 2>&1
+if [[ -s sandbox/scancache && `cat sandbox/cachedfirst` == `cat sandbox/cachedsecond` && `cat sandbox/notacache` == "not a cache" && `cat sandbox/cachedrefused` == *"as a cache"* ]]
+then
+	echo "OK : option --cache keeps scan results, and leaves other files alone"
+else
+	echo "FAILURE : option --cache changed the results, or clobbered a file that isn't a cache"
+	./case_failed.sh
+fi
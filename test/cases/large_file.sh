@@ -23,3 +23,30 @@ fi
 
 
 
+
+
+# large enough to be split in chunks that are converted in parallel with -j
+cp sandbox/bigunixintest sandbox/hugeunixintest
+while (( `wc -c <sandbox/hugeunixintest` < 40000000 ))
+do
+    cat sandbox/hugeunixintest sandbox/hugeunixintest > sandbox/hugetmp
+    mv sandbox/hugetmp sandbox/hugeunixintest
+done
+cp sandbox/hugeunixintest sandbox/hugeconverted
+
+$ENDLINES win -q -j 4 sandbox/hugeconverted
+$ENDLINES win -q <sandbox/hugeunixintest >sandbox/hugewinref 2>/dev/null
+HUGEWIN=`$MD5<sandbox/hugeconverted`
+HUGEWINREF=`$MD5<sandbox/hugewinref`
+
+$ENDLINES unix -q -j 4 sandbox/hugeconverted
+HUGEUNIXIN=`$MD5<sandbox/hugeunixintest`
+HUGEUNIXOUT=`$MD5<sandbox/hugeconverted`
+
+if [[ "$HUGEWIN" == "$HUGEWINREF" && "$HUGEUNIXIN" == "$HUGEUNIXOUT" ]]
+then
+    echo "OK : large file processing in parallel chunks with -j"
+else
+    echo "FAILURE : large file processing in parallel chunks with -j"
+    ./case_failed.sh
+fi
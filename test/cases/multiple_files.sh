@@ -113,4 +113,165 @@ else
 fi
 
 
+
+$ENDLINES unix -r -j 3 sandbox/subdir1 &>/dev/null
+
+FILE1A=`$MD5<sandbox/subdir1/file1a`
+FILE111B=`$MD5<sandbox/subdir1/subdir11/file111b`
+FILE112A=`$MD5<sandbox/subdir1/subdir12/file112a`
+FILE_INSIDE_HIDDEN=`$MD5<sandbox/subdir1/.hidden_subdir/file_inside_hidden`
+
+if [[ 
+    "$UNIXREF" == "$FILE1A" &&
+    "$UNIXREF" == "$FILE111B" &&
+    "$UNIXREF" == "$FILE112A" &&
+    "$WINREF" == "$FILE_INSIDE_HIDDEN"
+]]
+then
+    echo "OK : walked subdirectories in parallel with -r -j 3"
+else
+    echo "FAILURE : walking subdirectories in parallel with -r -j 3 went wrong"
+    ./case_failed.sh
+fi
+
+
 rm -rf sandbox/subdir1
+
+
+
+
+mkdir sandbox/manyfiles
+for i in `seq 1 150`
+do
+    if (( i % 3 ))
+    then
+        cp data/unixref sandbox/manyfiles/file$i
+    else
+        cp data/winref sandbox/manyfiles/file$i
+    fi
+done
+$ENDLINES unix -r -q sandbox/manyfiles >/dev/null 2>/dev/null
+
+UNIXREF=`$MD5<data/unixref`
+MANYFILES_OK=true
+for i in `seq 1 150`
+do
+    if [[ "`$MD5<sandbox/manyfiles/file$i`" != "$UNIXREF" ]]
+    then
+        MANYFILES_OK=false
+    fi
+done
+if [[ $MANYFILES_OK == true ]]
+then
+    echo "OK : converted a directory holding more files than a read batch"
+else
+    echo "FAILURE : failed to convert all files of a directory holding many files"
+    ./case_failed.sh
+fi
+
+$ENDLINES win -r -q -j 4 sandbox/manyfiles >/dev/null 2>/dev/null
+
+WINREF=`$MD5<data/winref`
+MANYFILES_OK=true
+for i in `seq 1 150`
+do
+    if [[ "`$MD5<sandbox/manyfiles/file$i`" != "$WINREF" ]]
+    then
+        MANYFILES_OK=false
+    fi
+done
+if [[ $MANYFILES_OK == true ]]
+then
+    echo "OK : converted a directory holding many files with -j 4"
+else
+    echo "FAILURE : failed to convert all files of a directory holding many files with -j 4"
+    ./case_failed.sh
+fi
+
+rm -r sandbox/manyfiles
+
+
+
+if [ -n "`command -v git`" ]
+then
+    rm -rf sandbox/gitrepo
+    mkdir sandbox/gitrepo
+    cp data/unixref sandbox/gitrepo/tracked
+    cp data/unixref sandbox/gitrepo/modified
+    cp data/unixref sandbox/gitrepo/untracked
+    touch -t 201901010000 sandbox/gitrepo/tracked sandbox/gitrepo/modified
+    (cd sandbox/gitrepo && git init -q . && git add tracked modified)
+    cp data/winref sandbox/gitrepo/modified
+
+    $ENDLINES check -v --git-changed sandbox/gitrepo >sandbox/gitchanged 2>&1
+    $ENDLINES win --git sandbox/gitrepo &>/dev/null
+    TRACKED=`$MD5<sandbox/gitrepo/tracked`
+    UNTRACKED=`$MD5<sandbox/gitrepo/untracked`
+    if [[
+        "$WINREF" == "$TRACKED" &&
+        "$UNIXREF" == "$UNTRACKED" &&
+        `cat sandbox/gitchanged` == *"CRLF -- sandbox/gitrepo/modified"* &&
+        `cat sandbox/gitchanged` != *"-- sandbox/gitrepo/tracked"*
+    ]]
+    then
+        echo "OK : --git processes the files git tracks, and --git-changed those that changed"
+    else
+        echo "FAILURE : --git processed untracked files, or --git-changed unchanged ones"
+        ./case_failed.sh
+    fi
+    rm -rf sandbox/gitrepo
+fi
+
+
+
+cp data/unixref sandbox/listed1
+cp data/unixref sandbox/listed2
+cp data/unixref sandbox/unlisted
+printf 'sandbox/listed1\0sandbox/listed2\0' | $ENDLINES win --files-from - &>/dev/null
+printf 'sandbox/listed1\r\n\nsandbox/listed2\n' >sandbox/filelist
+$ENDLINES check --files-from=sandbox/filelist >sandbox/filelistcheck 2>&1
+LISTED1=`$MD5<sandbox/listed1`
+LISTED2=`$MD5<sandbox/listed2`
+UNLISTED=`$MD5<sandbox/unlisted`
+if [[
+    "$WINREF" == "$LISTED1" &&
+    "$WINREF" == "$LISTED2" &&
+    "$UNIXREF" == "$UNLISTED" &&
+    `cat sandbox/filelistcheck` == *"2 Windows"*
+]]
+then
+    echo "OK : --files-from processes the files listed, separated by NULs or newlines"
+else
+    echo "FAILURE : --files-from did not process exactly the files listed"
+    ./case_failed.sh
+fi
+
+
+
+if [[ `uname` == "Linux" && -n "`command -v timeout`" ]]
+then
+    rm -rf sandbox/watched
+    mkdir sandbox/watched
+    cp data/winref sandbox/watched/before
+    timeout 3 $ENDLINES unix --watch sandbox/watched &>/dev/null &
+    sleep 1
+    mkdir sandbox/watched/newdir
+    cp data/winref sandbox/watched/newdir/after
+    cp data/winref sandbox/watched/later
+    wait
+    BEFORE=`$MD5<sandbox/watched/before`
+    AFTER=`$MD5<sandbox/watched/newdir/after`
+    LATER=`$MD5<sandbox/watched/later`
+    if [[
+        "$UNIXREF" == "$BEFORE" &&
+        "$UNIXREF" == "$AFTER" &&
+        "$UNIXREF" == "$LATER"
+    ]]
+    then
+        echo "OK : --watch converts files, then files written to and new directories"
+    else
+        echo "FAILURE : --watch did not convert files as they were written to"
+        ./case_failed.sh
+    fi
+    rm -rf sandbox/watched
+fi
@@ -30,3 +30,25 @@ else
     ./case_failed.sh
 fi
 
+
+
+# Many blocks of lone LFs, that are counted a block at a time, up to a single CR-LF at the end.
+for ((i=1;i<=50;i++));
+do
+    cat data/unixref >> sandbox/lf_blocks_test
+done
+cp sandbox/lf_blocks_test sandbox/lf_blocks_ref
+printf 'end\r\n' >> sandbox/lf_blocks_test
+printf 'end\n' >> sandbox/lf_blocks_ref
+
+LF_BLOCKS_VERDICT=`$ENDLINES unix -v sandbox/lf_blocks_ref 2>/dev/null | grep -c "LF -- "`
+$ENDLINES unix sandbox/lf_blocks_test 2>/dev/null >/dev/null
+LF_BLOCKS_OUT=`$MD5<sandbox/lf_blocks_test`
+LF_BLOCKS_REF=`$MD5<sandbox/lf_blocks_ref`
+if [[ "$LF_BLOCKS_VERDICT" == "1" && "$LF_BLOCKS_OUT" == "$LF_BLOCKS_REF" ]]
+then
+    echo "OK : scans through line endings already in the target convention, up to the first one that's not"
+else
+    echo "FAILURE : scanning through line endings already in the target convention"
+    ./case_failed.sh
+fi
@@ -14,3 +14,86 @@ else
     echo "FAILURE : using with pipes yielded non matching output"
     ./case_failed.sh
 fi
+
+
+# With -j, stdin is read and stdout written on threads of their own : a CR-LF
+# that's split across two reads must still be seen whole.
+( cat data/winref ; printf 'a\r' ; sleep 0.2 ; printf '\nb' ) | $ENDLINES unix -j 2 2>/dev/null >sandbox/pipetest
+( cat data/unixref ; printf 'a\nb' ) >sandbox/pipereftest
+PIPETEST=`$MD5<sandbox/pipetest`
+PIPEREF=`$MD5<sandbox/pipereftest`
+
+if [[ "$PIPEREF" == "$PIPETEST" ]]
+then
+    echo "OK : using with pipes, reading and writing on threads of their own"
+else
+    echo "FAILURE : using with pipes, reading and writing on threads of their own, yielded non matching output"
+    ./case_failed.sh
+fi
+
+
+# Line endings that are already right are passed through by the kernel, where it can :
+# a CR at the end of a read must wait for the next one, to tell a CR-LF from a lone CR.
+( cat data/winref ; printf 'a\r' ; sleep 0.2 ; printf '\nb\r' ; sleep 0.2 ; printf 'c' ) | $ENDLINES win 2>/dev/null | cat >sandbox/pipetest
+( cat data/winref ; printf 'a\r\nb\r\nc' ) >sandbox/pipereftest
+PIPETEST=`$MD5<sandbox/pipetest`
+PIPEREF=`$MD5<sandbox/pipereftest`
+
+if [[ "$PIPEREF" == "$PIPETEST" ]]
+then
+    echo "OK : passing through pipes what needs no conversion"
+else
+    echo "FAILURE : passing through pipes what needs no conversion yielded non matching output"
+    ./case_failed.sh
+fi
+
+
+# Converting into CR, a CR-LF split across two reads is still one line ending.
+( cat data/oldmacref ; printf 'a\r' ; sleep 0.2 ; printf '\nb' ) | $ENDLINES oldmac 2>/dev/null | cat >sandbox/pipetest
+( cat data/oldmacref ; printf 'a\rb' ) >sandbox/pipereftest
+PIPETEST=`$MD5<sandbox/pipetest`
+PIPEREF=`$MD5<sandbox/pipereftest`
+
+if [[ "$PIPEREF" == "$PIPETEST" ]]
+then
+    echo "OK : passing through pipes a CR-LF split across two reads"
+else
+    echo "FAILURE : passing through pipes a CR-LF split across two reads yielded non matching output"
+    ./case_failed.sh
+fi
+
+
+# stdout can be a file opened for appending, that splice won't write to.
+printf 'a\n' >sandbox/pipetest
+cat data/unixref | $ENDLINES unix 2>/dev/null >>sandbox/pipetest
+( printf 'a\n' ; cat data/unixref ) >sandbox/pipereftest
+PIPETEST=`$MD5<sandbox/pipetest`
+PIPEREF=`$MD5<sandbox/pipereftest`
+
+if [[ "$PIPEREF" == "$PIPETEST" ]]
+then
+    echo "OK : appending to a file from a pipe"
+else
+    echo "FAILURE : appending to a file from a pipe yielded non matching output"
+    ./case_failed.sh
+fi
+
+
+# A producer may hand out the first byte of a BOM alone : the layout must still be told from both.
+slow_utf16_producer() {
+    head -c 1 data/utf16le_win_ref ; sleep 0.2 ; tail -c +2 data/utf16le_win_ref
+}
+rm -f sandbox/pipeappendtest
+slow_utf16_producer | $ENDLINES unix 2>/dev/null | cat >sandbox/pipetest
+slow_utf16_producer | $ENDLINES unix 2>/dev/null >sandbox/pipefiletest
+slow_utf16_producer | $ENDLINES unix 2>/dev/null >>sandbox/pipeappendtest
+PIPEREF=`$MD5<data/utf16le_unix_ref`
+
+if [[ `$MD5<sandbox/pipetest` == "$PIPEREF" && `$MD5<sandbox/pipefiletest` == "$PIPEREF" &&
+      `$MD5<sandbox/pipeappendtest` == "$PIPEREF" ]]
+then
+    echo "OK : telling the layout of a stream whose BOM comes in two reads"
+else
+    echo "FAILURE : telling the layout of a stream whose BOM comes in two reads"
+    ./case_failed.sh
+fi